@@ -0,0 +1,126 @@
+/*
+ * Tests of how bulk responses are handled. The bulk functions are static,
+ * so the library source is compiled into the test.
+ */
+#include "seatest.h"
+
+/* the library source has a main of its own */
+#define main transport_main
+#include "../transport.c"
+#undef main
+
+static transport_session_t * test_session = NULL;
+static transport_bulk_t * test_bulk = NULL;
+static int test_failures = 0;
+static int test_failure_status = 0;
+static char test_failure_error[TRANSPORT_ERROR_LEN + 1];
+
+static void
+test_on_failure(transport_bulk_t * bulk, const _bulk_item_r * item, const char * ndjson, size_t len, void * userdata) {
+    test_failures++;
+    test_failure_status = item->status;
+    strcpy(test_failure_error, item->error);
+    assert_true(len > 0 && ndjson[len - 1] == '\n');
+}
+
+static void
+test_setup(void) {
+    test_session = transport_session_new();
+    test_session->response_size = TRANSPORT_RESPONSE_LEN;
+    test_session->arena_size = TRANSPORT_ARENA_LEN;
+    test_bulk = transport_bulk_create(test_session, 0, 0, -1);
+    test_bulk->on_failure = test_on_failure;
+    test_failures = 0;
+    test_failure_status = 0;
+    test_failure_error[0] = '\0';
+}
+
+static void
+test_teardown(void) {
+    transport_bulk_destroy(test_bulk);
+    transport_destroy(test_session);
+    test_bulk = NULL;
+    test_session = NULL;
+}
+
+/**
+ * @brief Buffers two actions and answers them with a response.
+ *
+ * @param status HTTP status of the response
+ * @param response response body
+ *
+ * @return the result of handling the response.
+ */
+static int
+test_respond(long status, const char * response) {
+    assert_int_equal(0, transport_bulk_add(test_bulk, TRANS_BULK_INDEX, "books", NULL, "1", "{\"a\":1}"));
+    assert_int_equal(0, transport_bulk_add(test_bulk, TRANS_BULK_INDEX, "books", NULL, "2", "{\"a\":2}"));
+
+    test_session->raw.pos = 0;
+    test_session->stream = NULL;
+    transport_memorize_response((void *) response, 1, strlen(response), test_session);
+    test_session->status = status;
+    return transport_bulk_response(test_bulk);
+}
+
+static void
+test_bulk_success(void) {
+    assert_int_equal(TRANS_ERROR_BULK, test_respond(200, "{\"took\":3,\"errors\":true,\"items\":["
+        "{\"index\":{\"_index\":\"books\",\"_id\":\"1\",\"status\":201}},"
+        "{\"index\":{\"_index\":\"books\",\"_id\":\"2\",\"status\":400,"
+        "\"error\":{\"type\":\"mapper_parsing_exception\",\"reason\":\"bad a\"}}}]}"));
+    assert_ulong_equal(0, test_bulk->num_actions);
+    assert_ulong_equal(2, test_bulk->num_items);
+    assert_ulong_equal(1, test_session->bulk.errors);
+    assert_int_equal(1, test_failures);
+    assert_int_equal(400, test_failure_status);
+    assert_string_equal("bad a", test_failure_error);
+}
+
+static void
+test_bulk_retryable(void) {
+    /* throttled and unavailable clusters keep the batch buffered */
+    assert_int_equal(TRANS_ERROR_ELASTIC, test_respond(429, "{\"error\":{\"reason\":\"rejected\"},\"status\":429}"));
+    assert_ulong_equal(2, test_bulk->num_actions);
+    assert_int_equal(TRANS_ERROR_ELASTIC, test_respond(502, "<html>bad gateway</html>"));
+    assert_ulong_equal(4, test_bulk->num_actions);
+    assert_int_equal(502, test_session->error.status);
+    assert_int_equal(0, test_failures);
+}
+
+static void
+test_bulk_rejected(void) {
+    /* a batch that can never succeed fails every action and is dropped */
+    assert_int_equal(TRANS_ERROR_ELASTIC, test_respond(413, "{\"error\":{\"reason\":\"too large\"},\"status\":413}"));
+    assert_ulong_equal(0, test_bulk->num_actions);
+    assert_ulong_equal(0, test_bulk->body.pos);
+    assert_int_equal(2, test_failures);
+    assert_int_equal(413, test_failure_status);
+    assert_string_equal("too large", test_failure_error);
+
+    assert_int_equal(TRANS_ERROR_PARSE, test_respond(200, "not json"));
+    assert_ulong_equal(0, test_bulk->num_actions);
+    assert_int_equal(4, test_failures);
+}
+
+static void
+test_fixture_bulk(void) {
+    test_fixture_start();
+    fixture_setup(test_setup);
+    fixture_teardown(test_teardown);
+    run_test(test_bulk_success);
+    run_test(test_bulk_retryable);
+    run_test(test_bulk_rejected);
+    test_fixture_end();
+}
+
+static void
+all_tests(void) {
+    test_fixture_bulk();
+}
+
+int
+main(int argc, char ** argv) {
+    /* the runner returns non zero if all tests passed */
+    return seatest_testrunner(argc, argv, all_tests, NULL, NULL) ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+/*
+ * Tests of the streaming search parser. The parser functions are static,
+ * so the library source is compiled into the test.
+ */
+#include "seatest.h"
+
+/* the library source has a main of its own */
+#define main transport_main
+#include "../transport.c"
+#undef main
+
+/* Chunk sizes the responses are split into, the last one feeds it whole */
+static const size_t test_steps[] = {1, 2, 3, 5, 7, 11, 64, 0};
+
+static const char test_search_response[] =
+    "{\"took\":5,\"timed_out\":false,"
+    "\"_shards\":{\"total\":2,\"successful\":2,\"failed\":0,\"failures\":[]},"
+    "\"hits\":{\"total\":{\"value\":2,\"relation\":\"eq\"},\"max_score\":1.5,\"hits\":["
+    "{\"_index\":\"books\",\"_type\":\"_doc\",\"_id\":\"a\\\"b\",\"_score\":1.5,"
+    "\"_source\":{\"_id\":\"inner\",\"n\":[1,2],\"t\":{\"hits\":{\"total\":9}}},\"sort\":[1.5,\"a\"]},"
+    "{\"_index\":\"books\",\"_type\":\"_doc\",\"_id\":\"2\",\"_score\":0.5,\"_source\":{\"title\":\"y\"}}"
+    "]}}";
+
+static const char test_msearch_response[] =
+    "{\"took\":7,\"responses\":["
+    "{\"took\":1,\"timed_out\":false,\"hits\":{\"total\":1,\"max_score\":1.0,\"hits\":["
+    "{\"_index\":\"a\",\"_id\":\"1\",\"_score\":1.0,\"_source\":{\"k\":1}}]},\"status\":200},"
+    "{\"error\":{\"type\":\"index_not_found_exception\",\"reason\":\"no such index\"},\"status\":404},"
+    "{\"took\":2,\"hits\":{\"total\":{\"value\":0},\"hits\":[]},\"status\":200}"
+    "]}";
+
+static transport_session_t * test_session = NULL;
+
+static void
+test_setup(void) {
+    test_session = transport_session_new();
+    test_session->response_size = TRANSPORT_RESPONSE_LEN;
+    test_session->arena_size = TRANSPORT_ARENA_LEN;
+}
+
+static void
+test_teardown(void) {
+    transport_destroy(test_session);
+    test_session = NULL;
+}
+
+/**
+ * @brief Feeds a response to the streaming parser the way curl delivers
+ * it, step bytes at a time.
+ *
+ * @param session transport session struct
+ * @param stream parser callbacks
+ * @param response response body
+ * @param step chunk size, 0 for the whole response
+ */
+static void
+test_feed(transport_session_t * session, const yajl_callbacks * stream, const char * response, size_t step) {
+    size_t len = strlen(response);
+
+    session->raw.pos = 0;
+    transport_arena_reset(session);
+    session->stream = stream;
+    assert_int_equal(0, transport_stream_reset(session));
+    for (size_t pos = 0; pos < len; pos += step) {
+        size_t n = step == 0 || pos + step > len ? len - pos : step;
+        assert_ulong_equal(n, transport_memorize_response((void *) &response[pos], 1, n, session));
+        if (step == 0) {
+            break;
+        }
+    }
+    session->status = 200;
+}
+
+static void
+test_span_equal(transport_session_t * session, transport_span_t span, const char * expected) {
+    assert_ulong_equal(strlen(expected), span.length);
+    assert_true(span.length == strlen(expected) && memcmp(TRANSPORT_SPAN(session, span), expected, span.length) == 0);
+}
+
+static void
+test_search_chunks(void) {
+    for (size_t i = 0; i < sizeof (test_steps) / sizeof (test_steps[0]); i++) {
+        _search_r * search = &test_session->search;
+        _hit_r * hit;
+
+        test_feed(test_session, &transport_search_callbacks, test_search_response, test_steps[i]);
+        assert_int_equal(0, transport_search_response(test_session));
+        assert_int_equal(TRANS_SESSION_TYPE_SEARCH, test_session->type);
+
+        assert_int_equal(5, search->took);
+        assert_int_equal(0, search->timed_out);
+        assert_int_equal(2, search->_shards.total);
+        assert_int_equal(2, search->_shards.successful);
+        assert_int_equal(0, search->_shards.failed);
+        assert_int_equal(2, search->hits.total);
+        assert_float_equal(1.5, search->hits.max_score, 0.001);
+        assert_ulong_equal(2, search->hits.num_hits);
+        if (search->hits.num_hits != 2) {
+            continue;
+        }
+
+        hit = &search->hits.hits[0];
+        assert_string_equal("books", hit->_index);
+        assert_string_equal("_doc", hit->_type);
+        assert_string_equal("a\"b", hit->_id);
+        assert_float_equal(1.5, hit->_score, 0.001);
+        assert_string_equal("{\"_id\":\"inner\",\"n\":[1,2],\"t\":{\"hits\":{\"total\":9}}}", hit->_source);
+        test_span_equal(test_session, hit->_index_span, "books");
+        test_span_equal(test_session, hit->_id_span, "a\\\"b");
+        test_span_equal(test_session, hit->_source_span, "{\"_id\":\"inner\",\"n\":[1,2],\"t\":{\"hits\":{\"total\":9}}}");
+        test_span_equal(test_session, hit->sort_span, "[1.5,\"a\"]");
+
+        hit = &search->hits.hits[1];
+        assert_string_equal("2", hit->_id);
+        assert_float_equal(0.5, hit->_score, 0.001);
+        assert_string_equal("{\"title\":\"y\"}", hit->_source);
+        test_span_equal(test_session, hit->_source_span, "{\"title\":\"y\"}");
+        assert_ulong_equal(0, hit->sort_span.length);
+    }
+}
+
+static void
+test_msearch_chunks(void) {
+    for (size_t i = 0; i < sizeof (test_steps) / sizeof (test_steps[0]); i++) {
+        _msearch_r * msearch = &test_session->msearch;
+        _hit_r * hit;
+
+        test_feed(test_session, &transport_msearch_callbacks, test_msearch_response, test_steps[i]);
+        assert_int_equal(0, transport_msearch_response(test_session));
+        assert_int_equal(TRANS_SESSION_TYPE_MSEARCH, test_session->type);
+        assert_ulong_equal(3, msearch->num_responses);
+        if (msearch->num_responses != 3) {
+            continue;
+        }
+
+        assert_int_equal(0, msearch->responses[0].error.status);
+        assert_int_equal(1, msearch->responses[0].search.took);
+        assert_int_equal(1, msearch->responses[0].search.hits.total);
+        assert_ulong_equal(1, msearch->responses[0].search.hits.num_hits);
+        if (msearch->responses[0].search.hits.num_hits == 1) {
+            hit = &msearch->responses[0].search.hits.hits[0];
+            assert_string_equal("a", hit->_index);
+            assert_string_equal("1", hit->_id);
+            assert_string_equal("{\"k\":1}", hit->_source);
+            test_span_equal(test_session, hit->_id_span, "1");
+            test_span_equal(test_session, hit->_source_span, "{\"k\":1}");
+        }
+
+        assert_int_equal(404, msearch->responses[1].error.status);
+        assert_string_equal("no such index", msearch->responses[1].error.error);
+        assert_ulong_equal(0, msearch->responses[1].search.hits.num_hits);
+
+        assert_int_equal(0, msearch->responses[2].error.status);
+        assert_int_equal(2, msearch->responses[2].search.took);
+        assert_ulong_equal(0, msearch->responses[2].search.hits.num_hits);
+    }
+}
+
+static void
+test_long_reason(void) {
+    char reason[TRANSPORT_ERROR_LEN + 64], response[TRANSPORT_ERROR_LEN + 256];
+
+    memset(reason, 'r', sizeof (reason) - 1);
+    reason[sizeof (reason) - 1] = '\0';
+
+    /* the reason is cut to fit session->error.error with its terminator */
+    snprintf(response, sizeof (response), "{\"error\":{\"type\":\"x\",\"reason\":\"%s\"},\"status\":400}", reason);
+    test_feed(test_session, &transport_search_callbacks, response, 7);
+    assert_int_equal(TRANS_ERROR_ELASTIC, transport_search_response(test_session));
+    assert_int_equal(400, test_session->error.status);
+    assert_ulong_equal(TRANSPORT_ERROR_LEN - 1, strlen(test_session->error.error));
+
+    /* and each slot of a multi search */
+    snprintf(response, sizeof (response), "{\"responses\":[{\"error\":{\"reason\":\"%s\"},\"status\":400}]}", reason);
+    test_feed(test_session, &transport_msearch_callbacks, response, 7);
+    assert_int_equal(0, transport_msearch_response(test_session));
+    assert_ulong_equal(1, test_session->msearch.num_responses);
+    if (test_session->msearch.num_responses == 1) {
+        assert_int_equal(400, test_session->msearch.responses[0].error.status);
+        assert_ulong_equal(TRANSPORT_ERROR_LEN - 1, strlen(test_session->msearch.responses[0].error.error));
+    }
+
+    /* and a multi search that failed as a whole */
+    snprintf(response, sizeof (response), "{\"error\":{\"reason\":\"%s\"},\"status\":400}", reason);
+    test_feed(test_session, &transport_msearch_callbacks, response, 7);
+    test_session->status = 400;
+    assert_int_equal(TRANS_ERROR_ELASTIC, transport_msearch_response(test_session));
+    assert_int_equal(400, test_session->error.status);
+    assert_ulong_equal(TRANSPORT_ERROR_LEN - 1, strlen(test_session->error.error));
+}
+
+static void
+test_fixture_parser(void) {
+    test_fixture_start();
+    fixture_setup(test_setup);
+    fixture_teardown(test_teardown);
+    run_test(test_search_chunks);
+    run_test(test_msearch_chunks);
+    run_test(test_long_reason);
+    test_fixture_end();
+}
+
+static void
+all_tests(void) {
+    test_fixture_parser();
+}
+
+int
+main(int argc, char ** argv) {
+    /* the runner returns non zero if all tests passed */
+    return seatest_testrunner(argc, argv, all_tests, NULL, NULL) ? 0 : 1;
+}
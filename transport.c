@@ -2,25 +2,138 @@
 
 static inline int transport_build_url(const char *, const char *, const char *, char *, size_t);
 static size_t transport_memorize_response(void *, size_t, size_t, void *);
-static int transport_call(transport_session_t *, const char *, int, const char *);
+static void transport_prepare(transport_session_t *, const char *, int, const char *, int, const yajl_callbacks *);
+static int transport_use_host(transport_session_t *, size_t, const char *);
+static transport_hosts_t * transport_hosts_create(const config_t *);
+static transport_hosts_t * transport_hosts_retain(transport_hosts_t *);
+static void transport_hosts_release(transport_hosts_t *);
+static size_t transport_hosts_pick(transport_hosts_t *);
+static int transport_hosts_failover(transport_session_t *, size_t *);
+static void transport_host_end(transport_session_t *, int);
+static void transport_hosts_sniff_start(transport_hosts_t *);
+static int transport_sniff(transport_session_t *);
+static int transport_call(transport_session_t *, const char *, int, const char *, const yajl_callbacks *);
+static int transport_perform(transport_session_t *, size_t, const char *, int);
+static int transport_failover(transport_session_t *, size_t, const char *);
+static int transport_call_hedged(transport_session_t *, const char *, int, const char *, const yajl_callbacks *);
+static int transport_response_error(transport_session_t *, yajl_val);
+static transport_multi_t * transport_multi_create(void);
+static int transport_submit(transport_multi_t *, transport_session_t *, const char *, int, const char *, const yajl_callbacks *, int (*)(transport_session_t *), transport_callback_t, void *);
+static void transport_detach(transport_session_t *);
+static void transport_dispatch(transport_multi_t *);
+static int transport_poll(transport_multi_t *, int);
+static void transport_multi_destroy(transport_multi_t *);
+static int transport_multi_socket(CURL *, curl_socket_t, int, void *, void *);
+static int transport_multi_timer(CURLM *, long, void *);
+static int transport_multi_events(transport_multi_t *, transport_socket_callback_t, transport_timer_callback_t, void *);
+static int transport_socket_action(transport_multi_t *, curl_socket_t, int);
+static int transport_async_search(transport_multi_t *, transport_session_t *, const char *, const char *, const char *, transport_callback_t, void *);
+static int transport_async_index_document(transport_multi_t *, transport_session_t *, const char *, const char *, const char *, const char *, transport_callback_t, void *);
+static int transport_async_http_get(transport_multi_t *, transport_session_t *, const char *, transport_callback_t, void *);
 static transport_session_t * transport_create(const char *);
+static transport_session_t * transport_session_new(void);
+static transport_config_t * transport_config_load(const char *);
+static void transport_config_destroy(transport_config_t *);
+static transport_session_t * transport_create_from(const transport_config_t *);
+static void transport_retry_configure(transport_retry_t *, const config_t *);
+static void transport_plan_hosts(CURL *, transport_hosts_t *);
+static transport_pool_t * transport_pool_create(const char *, size_t);
+static transport_session_t * transport_pool_checkout(transport_pool_t *);
+static void transport_pool_checkin(transport_session_t *);
+static void transport_pool_destroy(transport_pool_t *);
+static transport_session_t * transport_session_clone(transport_session_t *);
+static void transport_set_deadline(transport_session_t *, long long);
+static void transport_set_budget(transport_session_t *, long);
+static long long transport_now_ms(void);
+static long transport_config_ms(const config_t *, const char *, const char *, long);
+static transport_scroll_t * transport_scroll_create(transport_session_t *, const char *, const char *, const char *, const char *, int);
+static int transport_scroll_next(transport_scroll_t *, transport_session_t **);
+static void transport_scroll_destroy(transport_scroll_t *);
+static int transport_export(transport_session_t *, const char *, const char *, const char *, size_t, const char *, int);
 static int transport_http_get(transport_session_t *, const char *);
 static int transport_http_post(transport_session_t *, const char *, const char *);
 static int transport_http_put(transport_session_t *, const char *, const char *);
 static int transport_http_delete(transport_session_t *, const char *, const char *);
 static const char * transport_strerror(int);
 static int transport_search(transport_session_t *, const char *, const char *, const char *);
+static int transport_search_response(transport_session_t *);
+static int transport_msearch(transport_session_t *, const transport_msearch_query_t *, size_t);
+static int transport_msearch_response(transport_session_t *);
+static int transport_get(transport_session_t *, const char *, const char *, const char *);
+static int transport_mget(transport_session_t *, const char *, const char *, const char * const *, size_t);
+static int transport_exists(transport_session_t *, const char *, const char *, const char *);
+static int transport_stream_reset(transport_session_t *);
+static void transport_stream_feed(transport_session_t *);
+static int transport_stream_finish(transport_session_t *, const yajl_callbacks *);
 static int transport_create_index(transport_session_t *, const char *, const char *);
+static int transport_create_index_response(transport_session_t *);
 static int transport_delete_index(transport_session_t *, const char *);
+static int transport_delete_index_response(transport_session_t *);
 static int transport_index_document(transport_session_t *, const char *, const char *, const char *, const char *);
+static int transport_index_document_response(transport_session_t *);
 static int transport_refresh(transport_session_t *, const char *);
+static int transport_refresh_response(transport_session_t *);
 static void transport_destroy(transport_session_t *);
 static void transport_session_id(char *, size_t);
-static void transport_yajl_copy_callback(void *ctx, const char *str, size_t len);
-static void transport_yajl_check_status(yajl_gen_status status);
-static void transport_yajl_serialize_value(yajl_gen gen, yajl_val val);
-static void transport_yajl_copy_tree(str_t *f, yajl_val tree);
+static int transport_buf_reserve(buf_t *, size_t);
+static int transport_buf_append(buf_t *, const char *, size_t);
+static int transport_buf_append_json_string(buf_t *, const char *);
+static void transport_buf_free(buf_t *);
+static transport_block_t * transport_arena_block(transport_session_t *, size_t);
+static void * transport_arena_alloc(transport_session_t *, size_t);
+static void * transport_arena_realloc(transport_session_t *, void *, size_t);
+static void transport_arena_reset(transport_session_t *);
+static void transport_arena_free(transport_session_t *);
+static char * transport_arena_strndup(transport_session_t *, const char *, size_t);
+static yajl_val transport_tree_parse(transport_session_t *);
+static transport_bulk_t * transport_bulk_create(transport_session_t *, size_t, size_t, int);
+static int transport_bulk_add(transport_bulk_t *, int, const char *, const char *, const char *, const char *);
+static int transport_bulk_raw(transport_bulk_t *, const char *, size_t);
+static int transport_bulk_flush(transport_bulk_t *);
+static void transport_bulk_destroy(transport_bulk_t *);
 
+/* Arena block, allocations are carved from data */
+struct transport_block_s {
+    struct transport_block_s * next;
+    size_t size;
+    size_t used;
+    /* offset of the most recent allocation */
+    size_t last;
+    char data[];
+};
+
+/* Streaming parser state */
+struct transport_parser_s {
+    yajl_handle handle;
+    /* re-encodes the _source of the current hit */
+    yajl_gen gen;
+    /* bytes of session->raw fed to the parser so far, and where the chunk
+     * being parsed starts */
+    size_t consumed;
+    size_t chunk;
+    /* non zero once the response turned out not to be valid JSON */
+    int failed;
+    /* open containers and the current key of each of them */
+    size_t depth;
+    int keys[TRANSPORT_PARSE_DEPTH];
+    /* depth of the _source being parsed, 0 if none, and whether it is
+     * re-encoded into the hit */
+    size_t capture;
+    int encode;
+    /* number of hits entered so far, the current one is hits - 1, and the
+     * capacity of the hits array */
+    size_t hits;
+    size_t hits_size;
+    int error;
+    int status;
+    /* depth of the search responses in the JSON, 2 in the responses array
+     * of a multi search, the result and error they are parsed into, and the
+     * capacity of the multi search responses array */
+    size_t base;
+    _search_r * result;
+    _error_r * err;
+    size_t responses_size;
+};
 
 /**
  * @brief Function to generate a string of random chars.
@@ -42,676 +155,5368 @@ transport_session_id(char * str, size_t size) {
 }
 
 /**
- * @brief Function to construct URL to the elastic host.
+ * @brief Copies a part of a URL to the end of a URL, truncating it to the
+ * size of the buffer.
+ *
+ * @param url       URL buffer, zero terminated
+ * @param pos       length of the URL so far
+ * @param url_len   size of the URL buffer
+ * @param part      zero terminated part to append
+ *
+ * @return the new length of the URL.
+ */
+static inline size_t
+transport_url_append(char * url, size_t pos, size_t url_len, const char * part) {
+    while (*part != '\0' && pos + 1 < url_len) {
+        url[pos++] = *part++;
+    }
+    url[pos] = '\0';
+    return pos;
+}
+
+/**
+ * @brief Function to construct URL to the elastic host, in a single pass
+ * over its parts.
  *
  * @param index     The elastic index.
  * @param type      The elastic type
  * @param action    The elastic page
  * @param path_len  Size of the path buffer
  * 
- * @return The number of bytes written if the buffer was large enough, 
- * 0 on failure.
+ * @return The number of bytes written, 0 on failure.
  */
 static inline int
 transport_build_url(const char * index, const char * type, const char * action, char * path, size_t path_len) {
-    int written = 0;
-    if (index == NULL || strlen(index) == 0) {
+    size_t written;
+
+    if (index == NULL || index[0] == '\0' || path_len < 2) {
         return 0;
     }
-    if (type == NULL || strlen(type) == 0) {
-        if (action == NULL || strlen(action) == 0) {
-            written = snprintf(path, path_len, "%s", index);    
-        } else {
-            written = snprintf(path, path_len, "%s/%s", index, action);
-        }
-    } else {
-        if (action == NULL || strlen(action) == 0) {
-            written = snprintf(path, path_len, "%s/%s", index, type);
-        } else {
-            written = snprintf(path, path_len, "%s/%s/%s", index, type, action);
-        }
+    written = transport_url_append(path, 0, path_len, index);
+    if (type != NULL && type[0] != '\0') {
+        written = transport_url_append(path, written, path_len, "/");
+        written = transport_url_append(path, written, path_len, type);
+    }
+    if (action != NULL && action[0] != '\0') {
+        written = transport_url_append(path, written, path_len, "/");
+        written = transport_url_append(path, written, path_len, action);
     }
     return written;
 }
 
 /**
- * @brief curl write data callback function called within the context of 
- * curl_easy_perform.
+ * @brief Makes sure a growable buffer has room for len more bytes plus the
+ * terminating zero. The buffer grows geometrically.
  *
- * @param ptr pointer to the delivered data.
- * @param size size of 1 piece of data
- * @param nmemb number of pieces
- * @param userp user data
+ * @param buf buffer
+ * @param len number of bytes about to be appended
  *
- * @return the number of bytes actually taken care of.
+ * @return 0 on success, -1 if memory could not be allocated.
  */
-static size_t
-transport_memorize_response(void *ptr, size_t size, size_t nmemb, void * userp) {
-    
-    char * body;
-    yajl_val node, v;
+static int
+transport_buf_reserve(buf_t * buf, size_t len) {
+    size_t size;
+    char * buffer;
 
-    if (userp == NULL || ptr == NULL || size == 0 || nmemb == 0) {
+    if (buf->pos + len + 1 <= buf->size) {
         return 0;
     }
-
-    size_t realsize = size * nmemb;
-    transport_session_t * session = (transport_session_t *) userp;
-
-    /* reset response string */
-    session->raw.pos = 0;
-
-    /* check to see if this data exceeds the size of our buffer. If so, 
-     * return 0 to indicate a problem to curl. */
-    if (session->raw.pos + realsize > TRANSPORT_RESPONSE_LEN) {
-        return 0;
+    size = buf->size ? buf->size : TRANSPORT_BUFFER_LEN;
+    while (size < buf->pos + len + 1) {
+        size *= 2;
     }
+    if ((buffer = realloc(buf->buffer, size)) == NULL) {
+        return -1;
+    }
+    buf->buffer = buffer;
+    buf->size = size;
+    return 0;
+}
 
-    /* copy the data from the curl buffer into our response buffer */
-    memcpy((void *)&session->raw.buffer[session->raw.pos], ptr, realsize);
-
-    /* update the response string pos */
-    session->raw.pos += realsize;
-
-    /* the data must be zero terminated */
-    session->raw.buffer[session->raw.pos] = 0;
-
-    return realsize;
+/**
+ * @brief Appends len bytes of data to a growable buffer.
+ *
+ * @param buf buffer
+ * @param data data to append
+ * @param len size of data
+ *
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int
+transport_buf_append(buf_t * buf, const char * data, size_t len) {
+    if (transport_buf_reserve(buf, len) != 0) {
+        return -1;
+    }
+    memcpy(&buf->buffer[buf->pos], data, len);
+    buf->pos += len;
+    buf->buffer[buf->pos] = '\0';
+    return 0;
 }
 
 /**
- * @brief Performs a http request using curl.
+ * @brief Appends str to a growable buffer as a quoted and escaped JSON string.
  *
- * @param session transport session struct
- * @param path URL path
- * @param trans_method HTTP request method (enum)
- * @param payload HTTP request body
+ * @param buf buffer
+ * @param str zero terminated string
  *
- * @return 0 on success or transport error code.
+ * @return 0 on success, -1 if memory could not be allocated.
  */
 static int
-transport_call(transport_session_t * session, const char * path, int trans_method, const char * payload) {
-    char request_url[TRANSPORT_CALL_URL_LEN];
-    struct curl_slist *headers = NULL;
-    CURLcode res;
-    int ret = 0;
+transport_buf_append_json_string(buf_t * buf, const char * str) {
+    const char hex[] = "0123456789abcdef";
+    size_t len = strlen(str);
 
-    if (session == NULL) {
-        return TRANS_ERROR_INPUT;
+    /* worst case every char is escaped as \u00XX */
+    if (transport_buf_reserve(buf, len * 6 + 2) != 0) {
+        return -1;
+    }
+    buf->buffer[buf->pos++] = '"';
+    for (; *str; str++) {
+        unsigned char c = (unsigned char) *str;
+        if (c == '"' || c == '\\') {
+            buf->buffer[buf->pos++] = '\\';
+            buf->buffer[buf->pos++] = c;
+        } else if (c < 0x20) {
+            buf->buffer[buf->pos++] = '\\';
+            buf->buffer[buf->pos++] = 'u';
+            buf->buffer[buf->pos++] = '0';
+            buf->buffer[buf->pos++] = '0';
+            buf->buffer[buf->pos++] = hex[c >> 4];
+            buf->buffer[buf->pos++] = hex[c & 0xf];
+        } else {
+            buf->buffer[buf->pos++] = c;
+        }
     }
+    buf->buffer[buf->pos++] = '"';
+    buf->buffer[buf->pos] = '\0';
+    return 0;
+}
 
-    headers = curl_slist_append(headers, "Accept: application/json");
-    headers = curl_slist_append(headers, "charsets: utf-8");
-    curl_easy_setopt(session->curl, CURLOPT_HTTPHEADER, headers);
+/**
+ * @brief Releases the memory held by a growable buffer.
+ *
+ * @param buf buffer
+ */
+static void
+transport_buf_free(buf_t * buf) {
+    free(buf->buffer);
+    buf->buffer = NULL;
+    buf->pos = 0;
+    buf->size = 0;
+}
 
-    curl_easy_setopt(session->curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
-    curl_easy_setopt(session->curl, CURLOPT_TIMEOUT, session->timeout);
+/**
+ * @brief Allocates a new arena block and makes it the current one.
+ *
+ * @param session transport session struct
+ * @param size usable size of the block
+ *
+ * @return the block or NULL on failure.
+ */
+static transport_block_t *
+transport_arena_block(transport_session_t * session, size_t size) {
+    transport_block_t * block;
 
-    switch (trans_method) {
-    case TRANS_METHOD_GET:
-        curl_easy_setopt(session->curl, CURLOPT_CUSTOMREQUEST, "GET");
-        /**
-         * Force the HTTP request to get back to using GET if a POST, HEAD, PUT, etc has
-         * been used previously using the same curl handle.
-         */
-        curl_easy_setopt(session->curl, CURLOPT_HTTPGET, 1L);
-        break;
-    case TRANS_METHOD_POST:
-        curl_easy_setopt(session->curl, CURLOPT_CUSTOMREQUEST, "POST");
-        if (payload != NULL) {
-            curl_easy_setopt(session->curl, CURLOPT_POSTFIELDS, payload);
-        }
-        break;
-    case TRANS_METHOD_PUT:
-        curl_easy_setopt(session->curl, CURLOPT_CUSTOMREQUEST, "PUT");
-        if (payload != NULL) {
-            curl_easy_setopt(session->curl, CURLOPT_POSTFIELDS, payload);
-        }
-        break;
-    case TRANS_METHOD_DELETE:
-        curl_easy_setopt(session->curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-        if (payload != NULL) {
-            curl_easy_setopt(session->curl, CURLOPT_POSTFIELDS, payload);
-        }
-        break;
+    if ((block = malloc(sizeof (transport_block_t) + size)) == NULL) {
+        return NULL;
     }
+    session->allocs++;
+    block->next = session->arena;
+    block->size = size;
+    block->used = 0;
+    block->last = 0;
+    session->arena = block;
+    return block;
+}
 
-    curl_easy_setopt(session->curl, CURLOPT_FORBID_REUSE, 0);
-    curl_easy_setopt(session->curl, CURLOPT_WRITEFUNCTION, transport_memorize_response);
-    curl_easy_setopt(session->curl, CURLOPT_WRITEDATA, session);
+/**
+ * @brief Allocates memory from the session arena. The memory lives until
+ * the arena is reset at the start of the next request or host attempt.
+ *
+ * @param session transport session struct
+ * @param size number of bytes
+ *
+ * @return pointer to the memory or NULL on failure.
+ */
+static void *
+transport_arena_alloc(transport_session_t * session, size_t size) {
+    transport_block_t * block = session->arena;
+    size_t need = TRANSPORT_ARENA_ALIGN + ((size + TRANSPORT_ARENA_ALIGN - 1) & ~(size_t) (TRANSPORT_ARENA_ALIGN - 1));
+    char * ptr;
 
-    for (int i = 0; i < session->num_hosts; i++) {
-        snprintf(request_url, TRANSPORT_CALL_URL_LEN, "%s/%s", session->hosts[i].host, path);
-        curl_easy_setopt(session->curl, CURLOPT_PORT, session->hosts[i].port);
-        curl_easy_setopt(session->curl, CURLOPT_URL, request_url);
-        if ((res = curl_easy_perform(session->curl)) == CURLE_OK) {
-            ret = 0;
-            break;
-        } else {
-            ret = res; /* return curl error code */
+    if (block == NULL || block->used + need > block->size) {
+        size_t grow = block != NULL ? block->size * 2 : session->arena_size;
+        if ((block = transport_arena_block(session, grow > need ? grow : need)) == NULL) {
+            return NULL;
         }
     }
 
-    return ret;
+    /* every allocation is preceded by its size, for realloc */
+    ptr = block->data + block->used;
+    *(size_t *) ptr = size;
+    block->last = block->used;
+    block->used += need;
+    return ptr + TRANSPORT_ARENA_ALIGN;
 }
 
-
 /**
- * @brief Performs an elastic search.
+ * @brief Resizes memory allocated from the session arena. The most recent
+ * allocation grows in place when the block has room.
  *
- * On a successfull search a pointer to the raw respose is stored in
- * session->raw.buffer and the size in session->raw.pos.
- *
- * @param session transport session struct.
- * @param index elastic index
- * @param type elastic typ
- * @param payload HTTP POST body
+ * @param session transport session struct
+ * @param ptr memory from transport_arena_alloc or NULL
+ * @param size new number of bytes
  *
- * @return 0 on success or transport error code.
+ * @return pointer to the memory or NULL on failure.
  */
-static int
-transport_search(transport_session_t * session, const char * index, const char * type, const char * payload) {
-    char path[TRANSPORT_CALL_URL_LEN];
-    const char * took_path[] = {"took", NULL},
-               * timed_out_path[] = {"timed_out", NULL},
-               * total_path[] = {"_shards", "total", NULL},
-               * successful_path[] = {"_shards", "successful", NULL},
-               * failed_path[] = {"_shards", "failed", NULL},
-               * status_path[] = {"status", NULL},
-               * error_path[] = {"error", NULL},
-               * hits_total_path[] = {"hits", "total", NULL},
-               * hits_max_score_path[] = {"hits", "max_score", NULL},
-               * hits_hits_path[] = {"hits", "hits", NULL},
-               * index_path[] = {"_index", NULL},
-               * type_path[] = {"_type", NULL},
-               * score_path[] = {"_score", NULL},
-               * source_path[] = {"_source", NULL},
-               * id_path[] = {"_id", NULL};
-
-    yajl_val node, v, h;
-    int ret = 0;
-    char eb[1024];
-
-    session->type = TRANS_SESSION_TYPE_NONE;
+static void *
+transport_arena_realloc(transport_session_t * session, void * ptr, size_t size) {
+    transport_block_t * block = session->arena;
+    size_t * header, need;
+    void * copy;
 
-    if (!transport_build_url(index, type, "_search", path, TRANSPORT_CALL_URL_LEN)) {
-        return TRANS_ERROR_URL;
+    if (ptr == NULL) {
+        return transport_arena_alloc(session, size);
     }
-    ret = transport_http_post(session, path, payload);
-    if (ret != 0) {
-        return ret;
+    header = (size_t *) ((char *) ptr - TRANSPORT_ARENA_ALIGN);
+    if (size <= *header) {
+        *header = size;
+        return ptr;
     }
-
-    /* parse response */
-    node = yajl_tree_parse(session->raw.buffer, eb, sizeof(eb));
-    if (node == NULL) {
-        return TRANS_ERROR_PARSE;
+    need = TRANSPORT_ARENA_ALIGN + ((size + TRANSPORT_ARENA_ALIGN - 1) & ~(size_t) (TRANSPORT_ARENA_ALIGN - 1));
+    if ((char *) header == block->data + block->last && block->last + need <= block->size) {
+        *header = size;
+        block->used = block->last + need;
+        return ptr;
+    }
+    if ((copy = transport_arena_alloc(session, size)) == NULL) {
+        return NULL;
     }
+    memcpy(copy, ptr, *header);
+    return copy;
+}
 
-    /* store error and status, if any, in document response */
-    if ((v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
-        ret = TRANS_ERROR_ELASTIC;
-        strncpy(session->error.error, YAJL_GET_STRING(v), TRANSPORT_ERROR_LEN);
-        if ((v = yajl_tree_get(node, status_path, yajl_t_number)) != NULL) {
-            session->error.status = atoi(YAJL_GET_NUMBER(v));
+/**
+ * @brief Releases all memory allocated from the session arena for reuse.
+ * If the last request needed more than one block they are merged into one
+ * block large enough for the next request.
+ *
+ * @param session transport session struct
+ */
+static void
+transport_arena_reset(transport_session_t * session) {
+    transport_block_t * block = session->arena, * next;
+    size_t size = 0;
+
+    if (block == NULL) {
+        return;
+    }
+    if (block->next != NULL) {
+        for (; block != NULL; block = next) {
+            next = block->next;
+            size += block->size;
+            free(block);
         }
-        session->type = TRANS_SESSION_TYPE_ERROR;
+        session->arena = NULL;
+        transport_arena_block(session, size);
     } else {
-        if ((v = yajl_tree_get(node, took_path, yajl_t_number)) != NULL) {
-            session->search.took = YAJL_GET_INTEGER(v);
-        }
-        if ((v = yajl_tree_get(node, timed_out_path, yajl_t_true)) != NULL) {
-            session->search.timed_out = YAJL_IS_TRUE(v) ? 1 : 0;
-        }
-        if ((v = yajl_tree_get(node, total_path, yajl_t_number)) != NULL) {
-            session->search._shards.total = YAJL_GET_INTEGER(v);
-        }
-        if ((v = yajl_tree_get(node, successful_path, yajl_t_number)) != NULL) {
-            session->search._shards.successful = YAJL_GET_INTEGER(v);
-        }
-        if ((v = yajl_tree_get(node, failed_path, yajl_t_number)) != NULL) {
-            session->search._shards.failed = YAJL_GET_INTEGER(v);
-        }
-        if ((v = yajl_tree_get(node, hits_total_path, yajl_t_number)) != NULL) {
-            session->search.hits.total = YAJL_GET_INTEGER(v);
-        }
-        if ((v = yajl_tree_get(node, hits_max_score_path, yajl_t_number)) != NULL) {
-            session->search.hits.max_score = YAJL_GET_DOUBLE(v);
-        }
-        if ((v = yajl_tree_get(node, hits_hits_path, yajl_t_array)) != NULL) {
-            size_t len = v->u.array.len;
-            for (int i = 0; i < len && i < TRANSPORT_MAX_NUM_HITS; ++i) {
-                yajl_val obj = v->u.array.values[i];
-                if ((h = yajl_tree_get(obj, index_path, yajl_t_string)) != NULL) {
-                    strncpy(session->search.hits.hits[i]._index, YAJL_GET_STRING(h), TRANSPORT_INDEX_LEN);
-                }
-                if ((h = yajl_tree_get(obj, type_path, yajl_t_string)) != NULL) {
-                    strncpy(session->search.hits.hits[i]._type, YAJL_GET_STRING(h), TRANSPORT_TYPE_LEN);
-                }
-                if ((h = yajl_tree_get(obj, id_path, yajl_t_string)) != NULL) {
-                    strncpy(session->search.hits.hits[i]._id, YAJL_GET_STRING(h), TRANSPORT_ID_LEN);
-                }
-                if ((h = yajl_tree_get(obj, score_path, yajl_t_number)) != NULL) {
-                    session->search.hits.hits[i]._score = YAJL_GET_DOUBLE(h);
-                }
-                if ((h = yajl_tree_get(obj, source_path, yajl_t_object)) != NULL) {
-                    if (YAJL_IS_OBJECT(h)) {
-                        str_t str = {0};
-                        transport_yajl_copy_tree(&str, h);
-                        strncpy(session->search.hits.hits[i]._source, str.buffer, str.pos);
-                        session->search.hits.hits[i]._source[str.pos] = '\0';
-                    }
-                }
-            }
-        }
-        session->type = TRANS_SESSION_TYPE_SEARCH;
+        block->used = 0;
+        block->last = 0;
     }
-    return ret;
-}
-
 
-static void 
-transport_yajl_copy_callback(void *ctx, const char *str, size_t len) {
-    str_t * f = (str_t *) ctx;
-    memcpy((void *)&f->buffer[f->pos], str, len);
-    f->pos += len;
-}
- 
-static void 
-transport_yajl_check_status(yajl_gen_status status) {
-    if (status != yajl_gen_status_ok) {
-        fprintf (stderr, "yajl_gen_status was %d\n", (int) status);
-        exit (EXIT_FAILURE);
+    /* everything the parser allocated is gone */
+    if (session->parser != NULL) {
+        session->parser->handle = NULL;
+        session->parser->gen = NULL;
     }
 }
- 
+
+/**
+ * @brief Frees all blocks of the session arena.
+ *
+ * @param session transport session struct
+ */
 static void
-transport_yajl_serialize_value(yajl_gen gen, yajl_val val) {
-    size_t i;
+transport_arena_free(transport_session_t * session) {
+    transport_block_t * block, * next;
 
-    switch(val->type) {
-    case yajl_t_string:
-        transport_yajl_check_status(yajl_gen_string (gen, (const unsigned char *) val->u.string, strlen (val->u.string)));
-        break;
-    case yajl_t_number:
-        transport_yajl_check_status(yajl_gen_number(gen, YAJL_GET_NUMBER (val), strlen (YAJL_GET_NUMBER (val))));
-        break;
-    case yajl_t_object:
-        transport_yajl_check_status(yajl_gen_map_open(gen));
-        for (i = 0 ;  i < val->u.object.len; i++) {
-            transport_yajl_check_status(yajl_gen_string (gen, (const unsigned char *) val->u.object.keys[i], strlen (val->u.object.keys[i])));
-            transport_yajl_serialize_value(gen, val->u.object.values[i]);
-        }
-        transport_yajl_check_status(yajl_gen_map_close(gen));
-        break;
-    case yajl_t_array:
-        transport_yajl_check_status(yajl_gen_array_open(gen));
-        for (i = 0; i < val->u.array.len;  i++) {
-            transport_yajl_serialize_value(gen, val->u.array.values[i]);
-        }
-        transport_yajl_check_status(yajl_gen_array_close(gen));
-        break;
-    case yajl_t_true:
-        transport_yajl_check_status(yajl_gen_bool(gen, 1));
-        break;
-    case yajl_t_false:
-        transport_yajl_check_status(yajl_gen_bool(gen, 0));
-        break;
-    case yajl_t_null:
-        transport_yajl_check_status(yajl_gen_null(gen));
-        break;
-    default:
-        fprintf (stderr, "unexpectedly got type %d\n", (int) val->type);
-        exit (EXIT_FAILURE);
+    for (block = session->arena; block != NULL; block = next) {
+        next = block->next;
+        free(block);
     }
+    session->arena = NULL;
 }
 
-static void
-transport_yajl_copy_tree(str_t * f, yajl_val tree) {
-    yajl_gen gen;
- 
-    if ((gen = yajl_gen_alloc(NULL)) == NULL) {
-        fprintf (stderr, "yajl_gen_alloc failed\n");
-        exit(EXIT_FAILURE);
-    }
- 
-    if (0 == yajl_gen_config(gen, yajl_gen_print_callback, transport_yajl_copy_callback, f)) {
-        fprintf(stderr, "yajl_gen_config failed\n");
-        exit(EXIT_FAILURE);
-    }
+static void *
+transport_yajl_malloc(void * ctx, size_t size) {
+    return transport_arena_alloc((transport_session_t *) ctx, size);
+}
+
+static void *
+transport_yajl_realloc(void * ctx, void * ptr, size_t size) {
+    return transport_arena_realloc((transport_session_t *) ctx, ptr, size);
+}
 
-    transport_yajl_serialize_value(gen, tree);
-    yajl_gen_free(gen);
+static void
+transport_yajl_free(void * ctx, void * ptr) {
+    /* arena memory is released all at once */
 }
 
 /**
- * @brief Creates a new elastic index.
+ * @brief Returns yajl allocation functions that allocate from the session
+ * arena.
  *
- * @param session transport session struct.
- * @param index elastic index
- * @aram payload HTTP PUT body
+ * @param session transport session struct
  *
- * @return 0 on success or transport error code.
+ * @return allocation functions, yajl copies them.
  */
-static int
-transport_create_index(transport_session_t * session, const char * index, const char * payload) {
-    char path[TRANSPORT_CALL_URL_LEN];
-    const char * acknowledged_path[] = {"acknowledged", NULL},
-           * status_path[] = {"status", NULL},
-           * error_path[] = {"error", NULL};
-    yajl_val node, v;
-    int ret = 0;
-    char eb[1024];
+static yajl_alloc_funcs
+transport_yajl_alloc_funcs(transport_session_t * session) {
+    yajl_alloc_funcs afs = {transport_yajl_malloc, transport_yajl_realloc, transport_yajl_free, session};
+    return afs;
+}
 
-    session->type = TRANS_SESSION_TYPE_NONE;
+/* State of transport_tree_parse */
+typedef struct {
+    transport_session_t * session;
+    yajl_val root;
+    yajl_val stack[TRANSPORT_PARSE_DEPTH];
+    size_t sizes[TRANSPORT_PARSE_DEPTH];
+    size_t depth;
+    const char * key;
+} transport_tree_t;
 
-    if (!transport_build_url(index, NULL, NULL, path, TRANSPORT_CALL_URL_LEN)) {
-        return TRANS_ERROR_URL;
-    }
-    ret = transport_http_put(session, path, payload);
-    if (ret != 0) {
-        return ret;
-    }
+/**
+ * @brief Allocates a zero terminated copy of a string in the session arena.
+ *
+ * @param session transport session struct
+ * @param str string, not zero terminated
+ * @param len length of str
+ *
+ * @return the copy or NULL on failure.
+ */
+static char *
+transport_arena_strndup(transport_session_t * session, const char * str, size_t len) {
+    char * copy;
 
-    /* parse response */
-    node = yajl_tree_parse(session->raw.buffer, eb, sizeof(eb));
-    if (node == NULL) {
-        return TRANS_ERROR_PARSE;
+    if ((copy = transport_arena_alloc(session, len + 1)) == NULL) {
+        return NULL;
     }
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
 
-    /* store error and status, if any, in document response */
-    if ((v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
-        ret = TRANS_ERROR_ELASTIC;
+/**
+ * @brief Adds a value to the object or array being built, or makes it the
+ * root of the tree.
+ *
+ * @param t tree state
+ * @param v value
+ *
+ * @return 1 on success, 0 to abort parsing.
+ */
+static int
+transport_tree_add(transport_tree_t * t, yajl_val v) {
+    yajl_val parent;
+    size_t len;
+
+    if (t->depth == 0) {
+        t->root = v;
+        return 1;
+    }
+    parent = t->stack[t->depth - 1];
+    if (YAJL_IS_OBJECT(parent)) {
+        len = parent->u.object.len;
+        if (len == t->sizes[t->depth - 1]) {
+            size_t size = len ? len * 2 : 8;
+            parent->u.object.keys = transport_arena_realloc(t->session, parent->u.object.keys, size * sizeof (const char *));
+            parent->u.object.values = transport_arena_realloc(t->session, parent->u.object.values, size * sizeof (yajl_val));
+            if (parent->u.object.keys == NULL || parent->u.object.values == NULL) {
+                return 0;
+            }
+            t->sizes[t->depth - 1] = size;
+        }
+        parent->u.object.keys[len] = t->key;
+        parent->u.object.values[len] = v;
+        parent->u.object.len++;
+    } else {
+        len = parent->u.array.len;
+        if (len == t->sizes[t->depth - 1]) {
+            size_t size = len ? len * 2 : 8;
+            if ((parent->u.array.values = transport_arena_realloc(t->session, parent->u.array.values, size * sizeof (yajl_val))) == NULL) {
+                return 0;
+            }
+            t->sizes[t->depth - 1] = size;
+        }
+        parent->u.array.values[len] = v;
+        parent->u.array.len++;
+    }
+    return 1;
+}
+
+/**
+ * @brief Allocates a tree node of the given type in the session arena and
+ * adds it to the tree.
+ *
+ * @param t tree state
+ * @param type node type
+ *
+ * @return the node or NULL on failure.
+ */
+static yajl_val
+transport_tree_node(transport_tree_t * t, yajl_type type) {
+    yajl_val v;
+
+    if ((v = transport_arena_alloc(t->session, sizeof (struct yajl_val_s))) == NULL) {
+        return NULL;
+    }
+    memset(v, 0, sizeof (struct yajl_val_s));
+    v->type = type;
+    return transport_tree_add(t, v) ? v : NULL;
+}
+
+static int
+transport_tree_null(void * ctx) {
+    return transport_tree_node((transport_tree_t *) ctx, yajl_t_null) != NULL;
+}
+
+static int
+transport_tree_boolean(void * ctx, int value) {
+    return transport_tree_node((transport_tree_t *) ctx, value ? yajl_t_true : yajl_t_false) != NULL;
+}
+
+static int
+transport_tree_number(void * ctx, const char * value, size_t len) {
+    transport_tree_t * t = (transport_tree_t *) ctx;
+    char * end;
+    yajl_val v;
+
+    if ((v = transport_tree_node(t, yajl_t_number)) == NULL) {
+        return 0;
+    }
+    if ((v->u.number.r = transport_arena_strndup(t->session, value, len)) == NULL) {
+        return 0;
+    }
+    v->u.number.i = strtoll(v->u.number.r, &end, 10);
+    if (*end == '\0') {
+        v->u.number.flags |= YAJL_NUMBER_INT_VALID;
+    }
+    v->u.number.d = strtod(v->u.number.r, &end);
+    if (*end == '\0') {
+        v->u.number.flags |= YAJL_NUMBER_DOUBLE_VALID;
+    }
+    return 1;
+}
+
+static int
+transport_tree_string(void * ctx, const unsigned char * value, size_t len) {
+    transport_tree_t * t = (transport_tree_t *) ctx;
+    yajl_val v;
+
+    if ((v = transport_tree_node(t, yajl_t_string)) == NULL) {
+        return 0;
+    }
+    return (v->u.string = transport_arena_strndup(t->session, (const char *) value, len)) != NULL;
+}
+
+static int
+transport_tree_start(transport_tree_t * t, yajl_type type) {
+    yajl_val v;
+
+    if (t->depth == TRANSPORT_PARSE_DEPTH || (v = transport_tree_node(t, type)) == NULL) {
+        return 0;
+    }
+    t->stack[t->depth] = v;
+    t->sizes[t->depth] = 0;
+    t->depth++;
+    return 1;
+}
+
+static int
+transport_tree_start_map(void * ctx) {
+    return transport_tree_start((transport_tree_t *) ctx, yajl_t_object);
+}
+
+static int
+transport_tree_start_array(void * ctx) {
+    return transport_tree_start((transport_tree_t *) ctx, yajl_t_array);
+}
+
+static int
+transport_tree_map_key(void * ctx, const unsigned char * key, size_t len) {
+    transport_tree_t * t = (transport_tree_t *) ctx;
+    return (t->key = transport_arena_strndup(t->session, (const char *) key, len)) != NULL;
+}
+
+static int
+transport_tree_end(void * ctx) {
+    ((transport_tree_t *) ctx)->depth--;
+    return 1;
+}
+
+static const yajl_callbacks transport_tree_callbacks = {
+    transport_tree_null,
+    transport_tree_boolean,
+    NULL,
+    NULL,
+    transport_tree_number,
+    transport_tree_string,
+    transport_tree_start_map,
+    transport_tree_map_key,
+    transport_tree_end,
+    transport_tree_start_array,
+    transport_tree_end
+};
+
+/**
+ * @brief Parses the raw response into a yajl tree allocated in the session
+ * arena. Unlike yajl_tree_parse no heap memory is used and the tree must
+ * not be freed, it is released when the arena is reset.
+ *
+ * @param session transport session struct
+ *
+ * @return the root of the tree or NULL if the response is not valid JSON.
+ */
+static yajl_val
+transport_tree_parse(transport_session_t * session) {
+    yajl_alloc_funcs afs = transport_yajl_alloc_funcs(session);
+    transport_tree_t t = {0};
+    yajl_handle handle;
+
+    t.session = session;
+    if ((handle = yajl_alloc(&transport_tree_callbacks, &afs, &t)) == NULL) {
+        return NULL;
+    }
+    if (yajl_parse(handle, (const unsigned char *) session->raw.buffer, session->raw.pos) != yajl_status_ok ||
+            yajl_complete_parse(handle) != yajl_status_ok) {
+        return NULL;
+    }
+    return t.root;
+}
+
+/**
+ * @brief curl write data callback function called within the context of 
+ * curl_easy_perform.
+ *
+ * @param ptr pointer to the delivered data.
+ * @param size size of 1 piece of data
+ * @param nmemb number of pieces
+ * @param userp user data
+ *
+ * @return the number of bytes actually taken care of.
+ */
+static size_t
+transport_memorize_response(void *ptr, size_t size, size_t nmemb, void * userp) {
+    
+    if (userp == NULL || ptr == NULL || size == 0 || nmemb == 0) {
+        return 0;
+    }
+
+    size_t realsize = size * nmemb;
+    transport_session_t * session = (transport_session_t *) userp;
+
+    /* append the data to the response buffer, returning 0 signals the
+     * allocation failure to curl. */
+    size_t capacity = session->raw.size;
+    if (capacity == 0 && transport_buf_reserve(&session->raw, session->response_size) != 0) {
+        return 0;
+    }
+    if (transport_buf_append(&session->raw, ptr, realsize) != 0) {
+        return 0;
+    }
+    session->bytes.received += realsize;
+    if (session->raw.size != capacity) {
+        session->allocs++;
+    }
+
+    /* parse the response while it is received */
+    if (session->stream != NULL) {
+        transport_stream_feed(session);
+    }
+
+    return realsize;
+}
+
+/**
+ * @brief Returns the time of a monotonic clock in milliseconds.
+ *
+ * @return milliseconds since an arbitrary point in the past.
+ */
+static long long
+transport_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Returns the time of a monotonic clock in microseconds.
+ *
+ * @return microseconds since an arbitrary point in the past.
+ */
+static long long
+transport_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Compresses a request body with gzip into the session's compressed
+ * buffer.
+ *
+ * @param session transport session struct
+ * @param payload request body
+ * @param len size of payload
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int
+transport_compress(transport_session_t * session, const char * payload, size_t len) {
+    long long started = transport_now_us();
+    z_stream zs;
+    int ret;
+
+    memset(&zs, 0, sizeof (zs));
+    /* 16 added to the window bits selects the gzip wrapper */
+    if (deflateInit2(&zs, session->compress_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    session->compressed.pos = 0;
+    if (transport_buf_reserve(&session->compressed, deflateBound(&zs, len)) != 0) {
+        deflateEnd(&zs);
+        return -1;
+    }
+    zs.next_in = (Bytef *) payload;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *) session->compressed.buffer;
+    zs.avail_out = session->compressed.size;
+    ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END) {
+        return -1;
+    }
+    session->compressed.pos = zs.total_out;
+    session->bytes.compress_us += transport_now_us() - started;
+    return 0;
+}
+
+/**
+ * @brief Checks whether the body of a request to path is NDJSON, as for
+ * _bulk and _msearch, rather than JSON.
+ *
+ * @param path URL path, optionally with a query string
+ *
+ * @return 1 if it is, 0 otherwise.
+ */
+static int
+transport_path_ndjson(const char * path) {
+    size_t len = strcspn(path, "?");
+
+    return (len >= 5 && strncmp(path + len - 5, "_bulk", 5) == 0) ||
+        (len >= 8 && strncmp(path + len - 8, "_msearch", 8) == 0);
+}
+
+/**
+ * @brief Sets the curl options of a request on the session's curl handle,
+ * the options that are the same for every request are set by
+ * transport_plan.
+ *
+ * @param session transport session struct
+ * @param path URL path, selects the Content-Type of the body
+ * @param trans_method HTTP request method (enum)
+ * @param payload HTTP request body
+ * @param copy non zero if curl must keep its own copy of the payload
+ * @param stream callbacks of the parser to feed the response to while it
+ * is received, or NULL
+ */
+static void
+transport_prepare(transport_session_t * session, const char * path, int trans_method, const char * payload, int copy, const yajl_callbacks * stream) {
+    CURLoption body = copy ? CURLOPT_COPYPOSTFIELDS : CURLOPT_POSTFIELDS;
+    int compressed = 0;
+
+    /* a body left over from a previous request must never be resent */
+    if (payload == NULL) {
+        payload = "";
+    }
+    session->body_len = trans_method == TRANS_METHOD_GET || trans_method == TRANS_METHOD_HEAD ? 0 : strlen(payload);
+    if (session->compress_threshold > 0 && session->body_len >= session->compress_threshold &&
+            transport_compress(session, payload, session->body_len) == 0) {
+        compressed = 1;
+    }
+
+    if (compressed) {
+        payload = session->compressed.buffer;
+    }
+    curl_easy_setopt(session->curl, CURLOPT_HTTPHEADER, session->headers[transport_path_ndjson(path) * 2 + compressed]);
+
+    /* the compressed body is binary, its size must be set before the body is copied */
+    curl_easy_setopt(session->curl, CURLOPT_POSTFIELDSIZE, compressed ? (long) session->compressed.pos : -1L);
+
+    /* only HEAD requests skip the response body */
+    curl_easy_setopt(session->curl, CURLOPT_NOBODY, trans_method == TRANS_METHOD_HEAD ? 1L : 0L);
+
+    switch (trans_method) {
+    case TRANS_METHOD_GET:
+        curl_easy_setopt(session->curl, CURLOPT_CUSTOMREQUEST, "GET");
+        /**
+         * Force the HTTP request to get back to using GET if a POST, HEAD, PUT, etc has
+         * been used previously using the same curl handle.
+         */
+        curl_easy_setopt(session->curl, CURLOPT_HTTPGET, 1L);
+        break;
+    case TRANS_METHOD_POST:
+        curl_easy_setopt(session->curl, CURLOPT_CUSTOMREQUEST, "POST");
+        curl_easy_setopt(session->curl, body, payload);
+        break;
+    case TRANS_METHOD_PUT:
+        curl_easy_setopt(session->curl, CURLOPT_CUSTOMREQUEST, "PUT");
+        curl_easy_setopt(session->curl, body, payload);
+        break;
+    case TRANS_METHOD_DELETE:
+        curl_easy_setopt(session->curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+        curl_easy_setopt(session->curl, body, payload);
+        break;
+    case TRANS_METHOD_HEAD:
+        curl_easy_setopt(session->curl, CURLOPT_CUSTOMREQUEST, NULL);
+        break;
+    }
+
+    session->stream = stream;
+    session->allocs = 0;
+}
+
+/* Strategy names as used in the config file */
+static const char * const transport_strategies[TRANS_STRATEGY_MAX] = {
+    "ordered",
+    "round_robin",
+    "random",
+    "least_outstanding",
+    "ewma"
+};
+
+/**
+ * @brief Resolves the names of hosts once, so that requests use the pinned
+ * addresses instead of resolving them again.
+ *
+ * @param hosts hosts
+ * @param num_hosts number of hosts
+ *
+ * @return a list of CURLOPT_RESOLVE entries, NULL if no name could be
+ * resolved.
+ */
+static struct curl_slist *
+transport_resolve(const transport_host_t * hosts, size_t num_hosts) {
+    struct curl_slist * list = NULL, * next;
+
+    for (size_t i = 0; i < num_hosts; i++) {
+        char name[TRANSPORT_HOST_LEN + 1], entry[TRANSPORT_RESOLVE_LEN], addr[NI_MAXHOST];
+        struct addrinfo hints, * res, * ai;
+        const char * start = strstr(hosts[i].host, "://");
+        size_t len, pos, resolved = 0;
+
+        /* the name is between the scheme and the port or path, IPv6
+         * literals need no resolving */
+        start = start != NULL ? start + 3 : hosts[i].host;
+        if ((len = strcspn(start, ":/")) == 0 || start[0] == '[') {
+            continue;
+        }
+        memcpy(name, start, len);
+        name[len] = '\0';
+
+        memset(&hints, 0, sizeof (hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(name, NULL, &hints, &res) != 0) {
+            continue;
+        }
+        pos = snprintf(entry, sizeof (entry), "%s:%d:", name, hosts[i].port);
+        for (ai = res; ai != NULL && pos < sizeof (entry); ai = ai->ai_next) {
+            if (getnameinfo(ai->ai_addr, ai->ai_addrlen, addr, sizeof (addr), NULL, 0, NI_NUMERICHOST) != 0) {
+                continue;
+            }
+            len = snprintf(entry + pos, sizeof (entry) - pos, ai->ai_family == AF_INET6 ? "%s[%s]" : "%s%s",
+                    resolved ? "," : "", addr);
+            if (pos + len >= sizeof (entry)) {
+                break;
+            }
+            pos += len;
+            resolved++;
+        }
+        entry[pos] = '\0';
+        freeaddrinfo(res);
+
+        if (resolved > 0) {
+            if ((next = curl_slist_append(list, entry)) == NULL) {
+                break;
+            }
+            list = next;
+        }
+    }
+    return list;
+}
+
+/**
+ * @brief Creates a host set from the hosts list and strategy of a
+ * configuration.
+ *
+ * @param cfg parsed configuration
+ *
+ * @return a host set with one reference, or NULL if no hosts are
+ * configured or memory could not be allocated.
+ */
+static transport_hosts_t *
+transport_hosts_create(const config_t * cfg) {
+    transport_hosts_t * set;
+    config_setting_t * setting;
+    const char * strategy = NULL, * unix_socket = NULL;
+    int host_count, value;
+
+    /* load hosts from config. */
+    if ((setting = config_lookup(cfg, "hosts")) == NULL || (host_count = config_setting_length(setting)) == 0) {
+        return NULL;
+    }
+    if ((set = calloc(1, sizeof (transport_hosts_t))) == NULL) {
+        return NULL;
+    }
+    if ((set->hosts = calloc(host_count, sizeof (transport_host_t))) == NULL) {
+        free(set);
+        return NULL;
+    }
+
+    /* store hosts in the set. */
+    for (int i = 0; i < host_count; ++i) {
+        const char * h = NULL;
+        config_setting_t * host = config_setting_get_elem(setting, i);
+        if (!(config_setting_lookup_string(host, "host", &h) && config_setting_lookup_int(host, "port", &set->hosts[set->num_hosts].port))) {
+            continue;
+        }
+        strncpy(set->hosts[set->num_hosts].host, h, TRANSPORT_HOST_LEN);
+        set->hosts[set->num_hosts].host_len = strlen(set->hosts[set->num_hosts].host);
+        set->num_hosts++;
+    }
+    if (set->num_hosts == 0) {
+        free(set->hosts);
+        free(set);
+        return NULL;
+    }
+
+    set->strategy = TRANS_STRATEGY_ORDERED;
+    if (config_lookup_string(cfg, "strategy", &strategy)) {
+        for (int i = 0; i < TRANS_STRATEGY_MAX; i++) {
+            if (strcmp(strategy, transport_strategies[i]) == 0) {
+                set->strategy = i;
+            }
+        }
+    }
+    if (!config_lookup_int(cfg, "dead_backoff", &value) || value <= 0) {
+        value = TRANSPORT_DEAD_BACKOFF;
+    }
+    set->dead_backoff = value;
+    if (!config_lookup_int(cfg, "dead_backoff_max", &value) || value < set->dead_backoff) {
+        value = TRANSPORT_DEAD_BACKOFF_MAX > set->dead_backoff ? TRANSPORT_DEAD_BACKOFF_MAX : set->dead_backoff;
+    }
+    set->dead_backoff_max = value;
+    if (!config_lookup_int(cfg, "sniff_interval", &value) || value < 0) {
+        value = 0;
+    }
+    set->sniff_interval = value;
+    set->timeout_ms = transport_config_ms(cfg, "timeout_ms", "timeout", TRANSPORT_DEFAULT_TIMEOUT * 1000L);
+    set->hedge_delay_ms = transport_config_ms(cfg, "hedge_delay_ms", NULL, 0);
+    if (!config_lookup_int(cfg, "hedge_percent", &set->hedge_percent) || set->hedge_percent < 0) {
+        set->hedge_percent = TRANSPORT_HEDGE_PERCENT;
+    }
+    if (!config_lookup_int(cfg, "write_limit_min", &value) || value <= 0) {
+        value = TRANSPORT_WRITE_LIMIT_MIN;
+    }
+    set->write_limit_min = value;
+    if (!config_lookup_int(cfg, "write_limit_max", &value) || value < set->write_limit_min) {
+        value = TRANSPORT_WRITE_LIMIT_MAX > set->write_limit_min ? TRANSPORT_WRITE_LIMIT_MAX : (int) set->write_limit_min;
+    }
+    set->write_limit_max = value;
+    if (config_lookup_int(cfg, "write_limit", &value) && value > 0) {
+        set->write_limit = value < set->write_limit_min ? set->write_limit_min :
+            value > set->write_limit_max ? set->write_limit_max : value;
+    }
+    set->write_latency_ms = transport_config_ms(cfg, "write_latency_ms", NULL, 0);
+    if (!config_lookup_bool(cfg, "tcp_nodelay", &set->tcp_nodelay)) {
+        set->tcp_nodelay = 1;
+    }
+    if (!config_lookup_int(cfg, "tcp_keepalive", &value) || value < 0) {
+        value = 0;
+    }
+    set->tcp_keepalive = value;
+    if (config_lookup_string(cfg, "unix_socket", &unix_socket) && (set->unix_socket = strdup(unix_socket)) == NULL) {
+        free(set->hosts);
+        free(set);
+        return NULL;
+    }
+    if (config_lookup_bool(cfg, "preresolve", &value) && value) {
+        set->resolve = transport_resolve(set->hosts, set->num_hosts);
+    }
+    if (!config_lookup_bool(cfg, "preconnect", &set->preconnect)) {
+        set->preconnect = 0;
+    }
+    set->seed = (unsigned int) rand();
+    set->refs = 1;
+    pthread_mutex_init(&set->lock, NULL);
+    pthread_cond_init(&set->write_slot, NULL);
+    return set;
+}
+
+/**
+ * @brief Adds a reference to a host set.
+ *
+ * @param set host set
+ *
+ * @return set
+ */
+static transport_hosts_t *
+transport_hosts_retain(transport_hosts_t * set) {
+    pthread_mutex_lock(&set->lock);
+    set->refs++;
+    pthread_mutex_unlock(&set->lock);
+    return set;
+}
+
+/**
+ * @brief Drops a reference to a host set, the last one frees it.
+ *
+ * @param set host set or NULL
+ */
+static void
+transport_hosts_release(transport_hosts_t * set) {
+    size_t refs;
+
+    if (set == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&set->lock);
+    refs = --set->refs;
+    pthread_mutex_unlock(&set->lock);
+    if (refs == 0) {
+        pthread_cond_destroy(&set->write_slot);
+        pthread_mutex_destroy(&set->lock);
+        curl_slist_free_all(set->resolve);
+        free(set->unix_socket);
+        free(set->hosts);
+        free(set);
+    }
+}
+
+
+/**
+ * @brief Marks a host dead after a failed connection, or alive again. Dead
+ * hosts are skipped for an exponentially growing time, after which a probe
+ * decides whether they are revived. Must be called with the set locked.
+ *
+ * @param set host set
+ * @param host host
+ * @param alive non zero if the host answered
+ */
+static void
+transport_host_mark(transport_hosts_t * set, transport_host_t * host, int alive) {
+    long long backoff = set->dead_backoff;
+
+    if (alive) {
+        host->dead_count = 0;
+        host->dead_until = 0;
+        return;
+    }
+    for (unsigned int i = 0; i < host->dead_count && backoff < set->dead_backoff_max; i++) {
+        backoff *= 2;
+    }
+    if (backoff > set->dead_backoff_max) {
+        backoff = set->dead_backoff_max;
+    }
+    host->dead_count++;
+    host->dead_until = transport_now_ms() + backoff;
+}
+
+/* A probe of a dead host, it works on a copy of the host so the set may
+ * change while it runs */
+typedef struct {
+    transport_hosts_t * set;
+    transport_host_t host;
+} transport_probe_t;
+
+/**
+ * @brief Probe thread, sends a HEAD request for / to a dead host and
+ * revives the host if it answers.
+ *
+ * @param arg probe
+ *
+ * @return NULL
+ */
+static void *
+transport_probe_thread(void * arg) {
+    transport_probe_t * probe = (transport_probe_t *) arg;
+    transport_hosts_t * set = probe->set;
+    char url[TRANSPORT_HOST_LEN + 2];
+    CURLcode res = CURLE_FAILED_INIT;
+    CURL * curl;
+
+    if ((curl = curl_easy_init()) != NULL) {
+        snprintf(url, sizeof (url), "%s/", probe->host.host);
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_PORT, probe->host.port);
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long) TRANSPORT_PROBE_TIMEOUT);
+        /* probe the way requests connect, the options never change once the set is loaded */
+        transport_plan_hosts(curl, set);
+        res = curl_easy_perform(curl);
+        curl_easy_cleanup(curl);
+    }
+
+    pthread_mutex_lock(&set->lock);
+    for (size_t i = 0; i < set->num_hosts; i++) {
+        transport_host_t * host = &set->hosts[i];
+        if (host->port == probe->host.port && strcmp(host->host, probe->host.host) == 0) {
+            transport_host_mark(set, host, res == CURLE_OK);
+            host->probing = 0;
+        }
+    }
+    pthread_mutex_unlock(&set->lock);
+
+    transport_hosts_release(set);
+    free(probe);
+    return NULL;
+}
+
+/**
+ * @brief Starts a background probe of a dead host whose backoff expired.
+ * Must be called with the set locked.
+ *
+ * @param set host set
+ * @param host host
+ */
+static void
+transport_host_probe(transport_hosts_t * set, transport_host_t * host) {
+    transport_probe_t * probe;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if ((probe = malloc(sizeof (transport_probe_t))) == NULL) {
+        return;
+    }
+    probe->set = set;
+    probe->host = *host;
+    /* the probe holds a reference, the set lock is already held */
+    set->refs++;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, transport_probe_thread, probe) == 0) {
+        host->probing = 1;
+    } else {
+        set->refs--;
+        free(probe);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * @brief Checks if a host may take requests, and starts a probe of a dead
+ * host once its backoff expired. Must be called with the set locked.
+ *
+ * @param set host set
+ * @param host host
+ * @param now current time in milliseconds
+ *
+ * @return non zero if the host is alive.
+ */
+static int
+transport_host_alive(transport_hosts_t * set, transport_host_t * host, long long now) {
+    if (host->dead_until == 0) {
+        return 1;
+    }
+    if (host->dead_until <= now && !host->probing) {
+        transport_host_probe(set, host);
+    }
+    return 0;
+}
+
+/**
+ * @brief Picks the host for the first attempt of a request according to
+ * the strategy of the set. Dead hosts are skipped, unless all hosts are
+ * dead in which case the one that died first is used.
+ *
+ * @param set host set
+ *
+ * @return index of the host in set->hosts.
+ */
+static size_t
+transport_hosts_pick(transport_hosts_t * set) {
+    size_t pick = set->num_hosts, start;
+    long long now = transport_now_ms();
+    double best = 0;
+
+    pthread_mutex_lock(&set->lock);
+    if (set->sniff_interval > 0 && !set->sniffing && now >= set->sniff_next) {
+        transport_hosts_sniff_start(set);
+    }
+    /* scans start at a rotating host so ties are spread evenly */
+    switch (set->strategy) {
+    case TRANS_STRATEGY_ORDERED:
+        start = 0;
+        break;
+    case TRANS_STRATEGY_RANDOM:
+        start = rand_r(&set->seed) % set->num_hosts;
+        break;
+    default:
+        start = set->next++ % set->num_hosts;
+        break;
+    }
+    for (size_t i = 0; i < set->num_hosts; i++) {
+        size_t h = (start + i) % set->num_hosts;
+        double score = (double) set->hosts[h].outstanding;
+
+        if (!transport_host_alive(set, &set->hosts[h], now)) {
+            continue;
+        }
+        if (set->strategy != TRANS_STRATEGY_LEAST_OUTSTANDING && set->strategy != TRANS_STRATEGY_EWMA) {
+            pick = h;
+            break;
+        }
+        /* expected latency of a request queued behind the outstanding ones */
+        if (set->strategy == TRANS_STRATEGY_EWMA) {
+            score = set->hosts[h].latency * (score + 1);
+        }
+        if (pick == set->num_hosts || score < best) {
+            best = score;
+            pick = h;
+        }
+    }
+    if (pick == set->num_hosts) {
+        pick = 0;
+        for (size_t h = 1; h < set->num_hosts; h++) {
+            if (set->hosts[h].dead_until < set->hosts[pick].dead_until) {
+                pick = h;
+            }
+        }
+    }
+    pthread_mutex_unlock(&set->lock);
+    return pick;
+}
+
+/**
+ * @brief Finds the next live host to fail over to. Hosts are tried in
+ * list order after the first one, each at most once.
+ *
+ * @param session transport session struct, session->attempt is advanced
+ * @param host set to the host to try
+ *
+ * @return non zero if there is a host left to try.
+ */
+static int
+transport_hosts_failover(transport_session_t * session, size_t * host) {
+    transport_hosts_t * set = session->hosts;
+    long long now = transport_now_ms();
+    int found = 0;
+
+    pthread_mutex_lock(&set->lock);
+    while (!found && ++session->attempt < set->num_hosts) {
+        *host = (session->first + session->attempt) % set->num_hosts;
+        found = transport_host_alive(set, &set->hosts[*host], now);
+    }
+    pthread_mutex_unlock(&set->lock);
+    return found;
+}
+
+/**
+ * @brief Checks if a curl error means the host could not be reached, as
+ * opposed to a slow or broken response.
+ *
+ * @param session transport session struct
+ * @param res curl result
+ *
+ * @return non zero if the host is unreachable.
+ */
+static int
+transport_host_unreachable(transport_session_t * session, int res) {
+    curl_off_t connected = 0;
+
+    switch (res) {
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_SSL_CONNECT_ERROR:
+        return 1;
+    case CURLE_OPERATION_TIMEDOUT:
+        /* only a timeout before the connection was established */
+        curl_easy_getinfo(session->curl, CURLINFO_CONNECT_TIME_T, &connected);
+        return connected == 0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Compares two longs for qsort.
+ */
+static int
+transport_compare_long(const void * a, const void * b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Records the latency of a successful request and refreshes the
+ * 95th percentile of the recent ones. Must be called with the set locked.
+ *
+ * @param set host set
+ * @param ms latency in milliseconds
+ */
+static void
+transport_hosts_sample(transport_hosts_t * set, long ms) {
+    long sorted[TRANSPORT_HEDGE_SAMPLES];
+
+    set->samples[set->num_samples++ % TRANSPORT_HEDGE_SAMPLES] = ms;
+    /* sorting is amortized over a few requests */
+    if (set->num_samples >= TRANSPORT_HEDGE_SAMPLES && set->num_samples % 16 == 0) {
+        memcpy(sorted, set->samples, sizeof (sorted));
+        qsort(sorted, TRANSPORT_HEDGE_SAMPLES, sizeof (long), transport_compare_long);
+        set->p95_ms = sorted[TRANSPORT_HEDGE_SAMPLES * 95 / 100];
+    }
+}
+
+/**
+ * @brief Adjusts the write limit after a write attempt: halves it when the
+ * cluster pushes back (429, 503, timeouts or a latency spike), at most once
+ * per average write latency so one burst of rejections counts once, and
+ * otherwise grows it by 1/limit while the limit is in use. Must be called
+ * with the set locked.
+ *
+ * @param set host set
+ * @param status HTTP status, 0 if none
+ * @param res curl result
+ * @param ms duration of the attempt in milliseconds
+ */
+static void
+transport_write_feedback(transport_hosts_t * set, long status, int res, double ms) {
+    double spike = set->write_latency_ms > 0 ? set->write_latency_ms : 2 * set->write_latency;
+    long long now;
+
+    if (set->write_limit == 0) {
+        return;
+    }
+    if (status == 429 || status == 503 || res == CURLE_OPERATION_TIMEDOUT ||
+            (res == CURLE_OK && spike > 0 && ms > spike)) {
+        now = transport_now_ms();
+        if (now - set->write_cut >= (set->write_latency > 1 ? set->write_latency : 1)) {
+            set->write_limit /= 2;
+            if (set->write_limit < set->write_limit_min) {
+                set->write_limit = set->write_limit_min;
+            }
+            set->write_cut = now;
+        }
+    } else if (res == CURLE_OK && set->writes + 1 >= (size_t) set->write_limit) {
+        set->write_limit += 1 / set->write_limit;
+        if (set->write_limit > set->write_limit_max) {
+            set->write_limit = set->write_limit_max;
+        }
+    }
+    if (res == CURLE_OK) {
+        set->write_latency = set->write_latency == 0 ? ms :
+            TRANSPORT_EWMA_WEIGHT * ms + (1 - TRANSPORT_EWMA_WEIGHT) * set->write_latency;
+    }
+}
+
+/**
+ * @brief Updates the statistics of the host a request was sent to once
+ * the request completed, and marks unreachable hosts dead.
+ *
+ * @param session transport session struct
+ * @param res curl result, CURLE_ABORTED_BY_CALLBACK for requests that
+ * were abandoned
+ */
+static void
+transport_host_end(transport_session_t * session, int res) {
+    transport_host_t * host;
+    int unreachable = res != CURLE_OK && transport_host_unreachable(session, res);
+    double seconds = 0;
+
+    session->status = 0;
+    if (res == CURLE_OK) {
+        curl_off_t sent = 0, received = 0;
+        curl_easy_getinfo(session->curl, CURLINFO_TOTAL_TIME, &seconds);
+        curl_easy_getinfo(session->curl, CURLINFO_RESPONSE_CODE, &session->status);
+        curl_easy_getinfo(session->curl, CURLINFO_SIZE_UPLOAD_T, &sent);
+        curl_easy_getinfo(session->curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+        session->bytes.sent += session->body_len;
+        session->bytes.sent_wire += sent;
+        session->bytes.received_wire += received;
+    } else {
+        /* a failed host is treated as if it answered at the timeout */
+        seconds = session->timeout_ms / 1000.0;
+    }
+
+    pthread_mutex_lock(&session->hosts->lock);
+    if (session->writing && res != CURLE_ABORTED_BY_CALLBACK) {
+        transport_write_feedback(session->hosts, session->status, res, seconds * 1000);
+    }
+    /* the request was sent to a host that sniffing has since replaced */
+    if (session->generation != session->hosts->generation) {
+        pthread_mutex_unlock(&session->hosts->lock);
+        return;
+    }
+    host = &session->hosts->hosts[session->host];
+    host->outstanding--;
+    if (res != CURLE_ABORTED_BY_CALLBACK) {
+        if (res != CURLE_OK) {
+            host->failures++;
+        }
+        host->requests++;
+        host->latency = host->requests == 1 ? seconds :
+            TRANSPORT_EWMA_WEIGHT * seconds + (1 - TRANSPORT_EWMA_WEIGHT) * host->latency;
+        if (res == CURLE_OK) {
+            transport_hosts_sample(session->hosts, (long) (seconds * 1000));
+        }
+        if (res == CURLE_OK || unreachable) {
+            transport_host_mark(session->hosts, host, !unreachable);
+        }
+    }
+    pthread_mutex_unlock(&session->hosts->lock);
+}
+
+/**
+ * @brief Takes one of the write limit's slots for a write. Blocking callers
+ * wait until a slot frees up or the session's deadline passes.
+ *
+ * @param session transport session struct
+ * @param wait non zero to wait for a slot
+ *
+ * @return 0 if a slot was taken or the limit is disabled,
+ * TRANS_ERROR_LIMIT if none is free and wait is 0, or
+ * CURLE_OPERATION_TIMEDOUT if the deadline passed while waiting.
+ */
+static int
+transport_write_acquire(transport_session_t * session, int wait) {
+    transport_hosts_t * set = session->hosts;
+    struct timespec until;
+    long long left;
+    int ret = 0;
+
+    pthread_mutex_lock(&set->lock);
+    while (set->write_limit > 0 && set->writes >= (size_t) set->write_limit) {
+        if (!wait) {
+            ret = TRANS_ERROR_LIMIT;
+            break;
+        }
+        if (session->deadline == 0) {
+            pthread_cond_wait(&set->write_slot, &set->lock);
+            continue;
+        }
+        /* condition variables wait on the realtime clock */
+        if ((left = session->deadline - transport_now_ms()) <= 0) {
+            ret = CURLE_OPERATION_TIMEDOUT;
+            break;
+        }
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += left / 1000;
+        until.tv_nsec += (left % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&set->write_slot, &set->lock, &until);
+    }
+    if (ret == 0 && set->write_limit > 0) {
+        set->writes++;
+        session->writing = 1;
+    }
+    pthread_mutex_unlock(&set->lock);
+    return ret;
+}
+
+/**
+ * @brief Gives back the write limit slot of a session, if it holds one.
+ *
+ * @param session transport session struct
+ */
+static void
+transport_write_release(transport_session_t * session) {
+    if (!session->writing) {
+        return;
+    }
+    pthread_mutex_lock(&session->hosts->lock);
+    session->hosts->writes--;
+    session->writing = 0;
+    pthread_cond_broadcast(&session->hosts->write_slot);
+    pthread_mutex_unlock(&session->hosts->lock);
+}
+
+/**
+ * @brief Replaces the hosts of a set. Hosts that are in both lists keep
+ * their statistics, requests in flight on the old hosts are no longer
+ * counted.
+ *
+ * @param set host set
+ * @param hosts new hosts, owned by the set afterwards
+ * @param num_hosts number of hosts, at least 1
+ */
+static void
+transport_hosts_swap(transport_hosts_t * set, transport_host_t * hosts, size_t num_hosts) {
+    transport_host_t * old;
+
+    pthread_mutex_lock(&set->lock);
+    for (size_t i = 0; i < num_hosts; i++) {
+        for (size_t j = 0; j < set->num_hosts; j++) {
+            if (hosts[i].port == set->hosts[j].port && strcmp(hosts[i].host, set->hosts[j].host) == 0) {
+                hosts[i] = set->hosts[j];
+                hosts[i].outstanding = 0;
+                break;
+            }
+        }
+    }
+    old = set->hosts;
+    set->hosts = hosts;
+    set->num_hosts = num_hosts;
+    set->generation++;
+    pthread_mutex_unlock(&set->lock);
+    free(old);
+}
+
+/**
+ * @brief Discovers the HTTP addresses of the cluster nodes with
+ * _nodes/http and makes them the hosts of the session's host set.
+ * Dedicated master nodes are left out. Every session sharing the set
+ * uses the new hosts from its next request on.
+ *
+ * @param session transport session struct.
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_sniff(transport_session_t * session) {
+    const char * nodes_path[] = {"nodes", NULL},
+           * address_path[] = {"http", "publish_address", NULL},
+           * roles_path[] = {"roles", NULL};
+    char scheme[TRANSPORT_HOST_LEN + 1] = "http://", * sep;
+    transport_host_t * hosts;
+    size_t num_hosts = 0;
+    yajl_val root, nodes, v;
+    int ret;
+
+    if (session == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    if ((ret = transport_call(session, "_nodes/http", TRANS_METHOD_GET, NULL, NULL)) != 0) {
+        return ret;
+    }
+    if ((root = transport_tree_parse(session)) == NULL) {
+        return TRANS_ERROR_PARSE;
+    }
+    if ((nodes = yajl_tree_get(root, nodes_path, yajl_t_object)) == NULL) {
+        return TRANS_ERROR_ELASTIC;
+    }
+
+    /* new hosts use the scheme of the host that answered */
+    pthread_mutex_lock(&session->hosts->lock);
+    if (session->generation == session->hosts->generation &&
+            (sep = strstr(session->hosts->hosts[session->host].host, "://")) != NULL) {
+        size_t len = sep + 3 - session->hosts->hosts[session->host].host;
+        memcpy(scheme, session->hosts->hosts[session->host].host, len);
+        scheme[len] = '\0';
+    }
+    pthread_mutex_unlock(&session->hosts->lock);
+
+    if ((hosts = calloc(YAJL_GET_OBJECT(nodes)->len + 1, sizeof (transport_host_t))) == NULL) {
+        return TRANS_ERROR_MEMORY;
+    }
+    for (size_t i = 0; i < YAJL_GET_OBJECT(nodes)->len; i++) {
+        yajl_val node = YAJL_GET_OBJECT(nodes)->values[i];
+        const char * address, * name;
+        char * port;
+        int len;
+
+        if ((v = yajl_tree_get(node, roles_path, yajl_t_array)) != NULL && YAJL_GET_ARRAY(v)->len == 1 &&
+                YAJL_IS_STRING(YAJL_GET_ARRAY(v)->values[0]) && strcmp(YAJL_GET_STRING(YAJL_GET_ARRAY(v)->values[0]), "master") == 0) {
+            continue;
+        }
+        if ((v = yajl_tree_get(node, address_path, yajl_t_string)) == NULL) {
+            continue;
+        }
+        /* publish_address is ip:port or hostname/ip:port */
+        address = YAJL_GET_STRING(v);
+        if ((name = strrchr(address, '/')) != NULL) {
+            address = name + 1;
+        }
+        if ((port = strrchr(address, ':')) == NULL || port == address) {
+            continue;
+        }
+        if ((len = snprintf(hosts[num_hosts].host, TRANSPORT_HOST_LEN + 1, "%s%.*s", scheme, (int) (port - address), address)) > TRANSPORT_HOST_LEN) {
+            continue;
+        }
+        hosts[num_hosts].host_len = len;
+        hosts[num_hosts].port = atoi(port + 1);
+        num_hosts++;
+    }
+    if (num_hosts == 0) {
+        free(hosts);
+        return TRANS_ERROR_ELASTIC;
+    }
+    transport_hosts_swap(session->hosts, hosts, num_hosts);
+    return 0;
+}
+
+/**
+ * @brief Sniff thread, refreshes the hosts of a set with a session of its
+ * own.
+ *
+ * @param arg host set
+ *
+ * @return NULL
+ */
+static void *
+transport_sniff_thread(void * arg) {
+    transport_hosts_t * set = (transport_hosts_t *) arg;
+    transport_session_t * session;
+
+    if ((session = transport_session_new()) != NULL) {
+        session->hosts = set;
+        transport_plan_hosts(session->curl, session->hosts);
+        session->timeout_ms = set->timeout_ms;
+        session->connect_timeout_ms = set->timeout_ms;
+        session->response_size = TRANSPORT_RESPONSE_LEN;
+        session->arena_size = TRANSPORT_ARENA_LEN;
+        transport_sniff(session);
+    }
+
+    pthread_mutex_lock(&set->lock);
+    set->sniffing = 0;
+    set->sniff_next = transport_now_ms() + set->sniff_interval * 1000LL;
+    pthread_mutex_unlock(&set->lock);
+
+    /* the session owns the reference taken for the thread */
+    if (session != NULL) {
+        transport_destroy(session);
+    } else {
+        transport_hosts_release(set);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts a background refresh of the hosts of a set. Must be called
+ * with the set locked.
+ *
+ * @param set host set
+ */
+static void
+transport_hosts_sniff_start(transport_hosts_t * set) {
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    /* the thread holds a reference, the set lock is already held */
+    set->refs++;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, transport_sniff_thread, set) == 0) {
+        set->sniffing = 1;
+    } else {
+        set->refs--;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * @brief Reads a duration in milliseconds from the configuration, or in
+ * seconds from a fallback setting.
+ *
+ * @param cfg parsed configuration
+ * @param name setting in milliseconds
+ * @param seconds setting in seconds, or NULL
+ * @param fallback value if neither is set
+ *
+ * @return milliseconds
+ */
+static long
+transport_config_ms(const config_t * cfg, const char * name, const char * seconds, long fallback) {
+    int value;
+
+    if (config_lookup_int(cfg, name, &value) && value > 0) {
+        return value;
+    }
+    if (seconds != NULL && config_lookup_int(cfg, seconds, &value) && value > 0) {
+        return value * 1000L;
+    }
+    return fallback;
+}
+
+/**
+ * @brief Sets the timeouts of the next attempt, limited by what is left of
+ * the session's deadline.
+ *
+ * @param session transport session struct
+ *
+ * @return 0 or CURLE_OPERATION_TIMEDOUT if the deadline has passed.
+ */
+static int
+transport_attempt_timeouts(transport_session_t * session) {
+    long timeout = session->timeout_ms, connect_timeout = session->connect_timeout_ms;
+
+    if (session->deadline > 0) {
+        long long left = session->deadline - transport_now_ms();
+        if (left <= 0) {
+            return CURLE_OPERATION_TIMEDOUT;
+        }
+        if (timeout <= 0 || left < timeout) {
+            timeout = left;
+        }
+        if (connect_timeout <= 0 || left < connect_timeout) {
+            connect_timeout = left;
+        }
+    }
+    curl_easy_setopt(session->curl, CURLOPT_TIMEOUT_MS, timeout);
+    curl_easy_setopt(session->curl, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout);
+    return 0;
+}
+
+/**
+ * @brief Points the session's curl handle at one of the configured hosts
+ * and counts the request as outstanding on it.
+ *
+ * @param session transport session struct
+ * @param host index of the host in session->hosts
+ * @param path URL path
+ *
+ * @return 0 or CURLE_OPERATION_TIMEDOUT if the deadline has passed, the
+ * request is not counted then.
+ */
+static int
+transport_use_host(transport_session_t * session, size_t host, const char * path) {
+    char request_url[TRANSPORT_CALL_URL_LEN];
+    const transport_host_t * h;
+
+    /* discard the response, or partial response of a failed host */
+    session->raw.pos = 0;
+    if (session->raw.buffer != NULL) {
+        session->raw.buffer[0] = '\0';
+    }
+    transport_arena_reset(session);
+    if (session->stream != NULL) {
+        transport_stream_reset(session);
+    }
+
+    /* sniffing may replace the hosts at any time */
+    pthread_mutex_lock(&session->hosts->lock);
+    session->host = host % session->hosts->num_hosts;
+    session->generation = session->hosts->generation;
+    h = &session->hosts->hosts[session->host];
+    memcpy(request_url, h->host, h->host_len);
+    request_url[h->host_len] = '/';
+    transport_url_append(request_url, h->host_len + 1, TRANSPORT_CALL_URL_LEN, path);
+    curl_easy_setopt(session->curl, CURLOPT_PORT, h->port);
+    pthread_mutex_unlock(&session->hosts->lock);
+
+    /* every attempt only gets what is left of the budget */
+    if (transport_attempt_timeouts(session) != 0) {
+        return CURLE_OPERATION_TIMEDOUT;
+    }
+    curl_easy_setopt(session->curl, CURLOPT_URL, request_url);
+
+    pthread_mutex_lock(&session->hosts->lock);
+    if (session->generation == session->hosts->generation) {
+        session->hosts->hosts[session->host].outstanding++;
+    }
+    pthread_mutex_unlock(&session->hosts->lock);
+    return 0;
+}
+
+/**
+ * @brief Performs a http request using curl.
+ *
+ * @param session transport session struct
+ * @param path URL path
+ * @param trans_method HTTP request method (enum)
+ * @param payload HTTP request body
+ * @param stream callbacks of the parser to feed the response to, or NULL
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_call(transport_session_t * session, const char * path, int trans_method, const char * payload, const yajl_callbacks * stream) {
+    if (session == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    if (session->multi != NULL) {
+        return TRANS_ERROR_BUSY;
+    }
+
+    transport_prepare(session, path, trans_method, payload, 0, stream);
+
+    /* the strategy picks the first host, failover walks the live rest in order */
+    session->first = transport_hosts_pick(session->hosts);
+    session->attempt = 0;
+    return transport_perform(session, session->first, path, 0);
+}
+
+/**
+ * @brief Checks whether the outcome of a request is worth retrying
+ * according to the session's retry policy.
+ *
+ * @param session transport session struct
+ * @param ret result of the request, 0 or a curl error code
+ *
+ * @return non zero if the request should be retried.
+ */
+static int
+transport_retryable(transport_session_t * session, int ret) {
+    const transport_retry_t * retry = &session->retry;
+
+    if (ret == 0) {
+        for (size_t i = 0; i < retry->num_statuses; i++) {
+            if (retry->statuses[i] == session->status) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < retry->num_curl_codes; i++) {
+        if (retry->curl_codes[i] == ret) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Sleeps before a retry, a random time of up to backoff_ms doubled
+ * for every previous retry and capped at backoff_max_ms ("full jitter").
+ *
+ * @param session transport session struct
+ * @param retries number of retries so far
+ *
+ * @return 0, or -1 if the retry would start after the session's deadline.
+ */
+static int
+transport_retry_wait(transport_session_t * session, int retries) {
+    long backoff = session->retry.backoff_ms, wait;
+
+    for (int i = 0; i < retries && backoff < session->retry.backoff_max_ms; i++) {
+        backoff *= 2;
+    }
+    if (backoff > session->retry.backoff_max_ms) {
+        backoff = session->retry.backoff_max_ms;
+    }
+    wait = backoff > 0 ? rand_r(&session->seed) % (backoff + 1) : 0;
+    if (session->deadline > 0 && transport_now_ms() + wait >= session->deadline) {
+        return -1;
+    }
+    usleep(wait * 1000);
+    return 0;
+}
+
+/**
+ * @brief Performs a prepared request on host, failing over to the hosts
+ * after it, and retries it according to the session's retry policy.
+ *
+ * @param session transport session struct
+ * @param host first host to try
+ * @param path URL path
+ * @param retries number of retries already made
+ *
+ * @return 0 on success or transport error code. A retryable HTTP status
+ * that is still returned after the last retry is left for the response
+ * parser.
+ */
+static int
+transport_perform(transport_session_t * session, size_t host, const char * path, int retries) {
+    int ret;
+
+    for (; ; retries++) {
+        ret = transport_failover(session, host, path);
+        if (retries >= session->retry.max_retries || !transport_retryable(session, ret) ||
+                transport_retry_wait(session, retries) != 0) {
+            return ret;
+        }
+        host = session->first = transport_hosts_pick(session->hosts);
+        session->attempt = 0;
+    }
+}
+
+/**
+ * @brief Performs a prepared request on host, failing over to the hosts
+ * after it on curl errors.
+ *
+ * @param session transport session struct
+ * @param host first host to try
+ * @param path URL path
+ *
+ * @return 0 on success or curl error code.
+ */
+static int
+transport_failover(transport_session_t * session, size_t host, const char * path) {
+    CURLcode res;
+    int ret = 0;
+
+    do {
+        if ((ret = transport_use_host(session, host, path)) != 0) {
+            break;
+        }
+        res = curl_easy_perform(session->curl);
+        transport_host_end(session, res);
+        if (res == CURLE_OK) {
+            ret = 0;
+            break;
+        } else {
+            ret = res; /* return curl error code */
+        }
+    } while (transport_hosts_failover(session, &host));
+
+    return ret;
+}
+
+/**
+ * @brief Performs a write within the adaptive write limit of the session's
+ * host set, waiting for a slot first if the limit is reached.
+ *
+ * @param session transport session struct
+ * @param path URL path
+ * @param trans_method HTTP request method (enum)
+ * @param payload HTTP request body
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_call_write(transport_session_t * session, const char * path, int trans_method, const char * payload) {
+    int ret;
+
+    if (session == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    if (session->multi != NULL) {
+        return TRANS_ERROR_BUSY;
+    }
+    if ((ret = transport_write_acquire(session, 1)) != 0) {
+        return ret;
+    }
+    ret = transport_call(session, path, trans_method, payload, NULL);
+    transport_write_release(session);
+    return ret;
+}
+
+/**
+ * @brief Decides whether a read may be hedged and after how long. Every
+ * call counts as a read, hedges are limited to hedge_percent of them.
+ *
+ * @param set host set
+ * @param delay set to the delay in milliseconds
+ *
+ * @return non zero if a hedge may be sent.
+ */
+static int
+transport_hedge_allowed(transport_hosts_t * set, long * delay) {
+    int allowed;
+
+    pthread_mutex_lock(&set->lock);
+    set->reads++;
+    allowed = set->num_hosts > 1 && (set->hedges + 1) * 100 <= set->reads * set->hedge_percent;
+    if (set->hedge_delay_ms > 0) {
+        *delay = set->hedge_delay_ms;
+    } else {
+        *delay = set->p95_ms > 0 ? set->p95_ms : TRANSPORT_HEDGE_DELAY;
+    }
+    pthread_mutex_unlock(&set->lock);
+    return allowed;
+}
+
+/**
+ * @brief Sends the hedge of a read to the next live host on the session's
+ * hedge handle.
+ *
+ * @param session transport session struct
+ * @param path URL path
+ * @param trans_method HTTP request method (enum)
+ * @param payload HTTP request body
+ *
+ * @return 0 if the hedge was sent.
+ */
+static int
+transport_hedge_start(transport_session_t * session, const char * path, int trans_method, const char * payload) {
+    transport_session_t * hedge = session->hedge;
+    size_t host;
+
+    hedge->deadline = session->deadline;
+    hedge->first = session->first;
+    hedge->attempt = 0;
+    if (!transport_hosts_failover(hedge, &host)) {
+        return -1;
+    }
+    transport_prepare(hedge, path, trans_method, payload, 0, NULL);
+    if (transport_use_host(hedge, host, path) != 0) {
+        return -1;
+    }
+    if (curl_multi_add_handle(session->hedge_multi, hedge->curl) != CURLM_OK) {
+        transport_host_end(hedge, CURLE_ABORTED_BY_CALLBACK);
+        return -1;
+    }
+    pthread_mutex_lock(&session->hosts->lock);
+    session->hosts->hedges++;
+    pthread_mutex_unlock(&session->hosts->lock);
+    return 0;
+}
+
+/**
+ * @brief Performs an idempotent read. With TRANS_OPTION_HEDGE, if the
+ * first host has not answered within the hedge delay the same request is
+ * sent to the next live host, the first successful response is used and
+ * the other request is cancelled. A retryable status from the winner is
+ * retried by the session's retry policy without hedging.
+ *
+ * @param session transport session struct
+ * @param path URL path
+ * @param trans_method HTTP request method (enum)
+ * @param payload HTTP request body
+ * @param stream callbacks of the parser to feed the response to, or NULL
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_call_hedged(transport_session_t * session, const char * path, int trans_method, const char * payload, const yajl_callbacks * stream) {
+    transport_session_t * done;
+    int active[2] = {0, 0}, hedged = 0, winner = -1, running, left, ret = 0;
+    long long started;
+    long delay;
+    size_t host;
+    CURLMsg * msg;
+
+    if (session == NULL || !(session->options & TRANS_OPTION_HEDGE) || session->multi != NULL ||
+            !transport_hedge_allowed(session->hosts, &delay)) {
+        return transport_call(session, path, trans_method, payload, stream);
+    }
+    if (session->hedge == NULL && (session->hedge = transport_session_clone(session)) == NULL) {
+        return transport_call(session, path, trans_method, payload, stream);
+    }
+    if (session->hedge_multi == NULL && (session->hedge_multi = curl_multi_init()) == NULL) {
+        return transport_call(session, path, trans_method, payload, stream);
+    }
+
+    transport_prepare(session, path, trans_method, payload, 0, stream);
+    session->first = transport_hosts_pick(session->hosts);
+    session->attempt = 0;
+    if ((ret = transport_use_host(session, session->first, path)) != 0) {
+        return ret;
+    }
+    if (curl_multi_add_handle(session->hedge_multi, session->curl) != CURLM_OK) {
+        transport_host_end(session, CURLE_ABORTED_BY_CALLBACK);
+        return TRANS_ERROR_CURL;
+    }
+    active[0] = 1;
+    started = transport_now_ms();
+
+    while (winner < 0 && (active[0] || active[1])) {
+        long long now;
+
+        if (curl_multi_perform(session->hedge_multi, &running) != CURLM_OK) {
+            ret = TRANS_ERROR_CURL;
+            break;
+        }
+        while ((msg = curl_multi_info_read(session->hedge_multi, &left)) != NULL) {
+            int i;
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &done);
+            i = done == session ? 0 : 1;
+            curl_multi_remove_handle(session->hedge_multi, done->curl);
+            active[i] = 0;
+            transport_host_end(done, msg->data.result);
+            if (msg->data.result == CURLE_OK) {
+                winner = i;
+                break;
+            }
+            ret = msg->data.result;
+        }
+        if (winner >= 0 || !(active[0] || active[1])) {
+            break;
+        }
+        now = transport_now_ms();
+        if (!hedged && now >= started + delay) {
+            hedged = 1;
+            active[1] = transport_hedge_start(session, path, trans_method, payload) == 0;
+        }
+        curl_multi_wait(session->hedge_multi, NULL, 0,
+                !hedged && started + delay > now ? (int) (started + delay - now) : TRANSPORT_HEDGE_WAIT, NULL);
+    }
+
+    /* cancel the request that lost */
+    if (active[0]) {
+        curl_multi_remove_handle(session->hedge_multi, session->curl);
+        transport_host_end(session, CURLE_ABORTED_BY_CALLBACK);
+    }
+    if (active[1]) {
+        curl_multi_remove_handle(session->hedge_multi, session->hedge->curl);
+        transport_host_end(session->hedge, CURLE_ABORTED_BY_CALLBACK);
+    }
+
+    /* the hedge's traffic is accounted to the session */
+    session->bytes.sent += session->hedge->bytes.sent;
+    session->bytes.sent_wire += session->hedge->bytes.sent_wire;
+    session->bytes.received += session->hedge->bytes.received;
+    session->bytes.received_wire += session->hedge->bytes.received_wire;
+    session->bytes.compress_us += session->hedge->bytes.compress_us;
+    memset(&session->hedge->bytes, 0, sizeof (transport_bytes_t));
+
+    if (winner == 1) {
+        /* use the hedge's response, the streaming parser starts over */
+        buf_t raw = session->raw;
+        session->raw = session->hedge->raw;
+        session->hedge->raw = raw;
+        session->status = session->hedge->status;
+        session->host = session->hedge->host;
+        session->generation = session->hedge->generation;
+        transport_arena_reset(session);
+    }
+    if (winner >= 0) {
+        /* a retryable status is retried without hedging, the race counts as the first try */
+        if (session->retry.max_retries > 0 && transport_retryable(session, 0) && transport_retry_wait(session, 0) == 0) {
+            session->first = transport_hosts_pick(session->hosts);
+            session->attempt = 0;
+            return transport_perform(session, session->first, path, 1);
+        }
+        return 0;
+    }
+    /* the first host failed before the hedge delay, fail over as usual */
+    if (ret != TRANS_ERROR_CURL && transport_hosts_failover(session, &host)) {
+        return transport_perform(session, host, path, 0);
+    }
+    return ret;
+}
+
+/**
+ * @brief Creates a handle for running requests asynchronously.
+ *
+ * @return a multi struct or NULL on failure.
+ */
+static transport_multi_t *
+transport_multi_create(void) {
+    transport_multi_t * multi = NULL;
+
+    if ((multi = calloc(1, sizeof (transport_multi_t))) == NULL) {
+        fprintf(stderr, "transport.multi_create() failed: could not initialize multi handle.\n");
+        return NULL;
+    }
+    if ((multi->multi = curl_multi_init()) == NULL) {
+        fprintf(stderr, "transport.multi_create() failed: could not initialize curl.\n");
+        free(multi);
+        return NULL;
+    }
+    return multi;
+}
+
+/**
+ * @brief Starts an asynchronous http request. The request is driven by
+ * transport.poll and callback is called once it has completed.
+ *
+ * @param multi multi struct
+ * @param session transport session struct, busy until the callback is called
+ * @param path URL path
+ * @param trans_method HTTP request method (enum)
+ * @param payload HTTP request body, copied
+ * @param stream callbacks of the parser to feed the response to, or NULL
+ * @param handler response parser, or NULL to keep the raw response only
+ * @param callback completion callback
+ * @param userdata passed to callback
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_submit(transport_multi_t * multi, transport_session_t * session, const char * path, int trans_method, const char * payload,
+        const yajl_callbacks * stream, int (* handler)(transport_session_t *), transport_callback_t callback, void * userdata) {
+    int ret;
+
+    if (multi == NULL || session == NULL || path == NULL || callback == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    if (session->multi != NULL) {
+        return TRANS_ERROR_BUSY;
+    }
+    if (strlen(path) >= TRANSPORT_CALL_URL_LEN) {
+        return TRANS_ERROR_URL;
+    }
+
+    strcpy(session->path, path);
+    session->attempt = 0;
+    session->handler = handler;
+    session->callback = callback;
+    session->userdata = userdata;
+
+    transport_prepare(session, path, trans_method, payload, 1, stream);
+    session->first = transport_hosts_pick(session->hosts);
+    if ((ret = transport_use_host(session, session->first, session->path)) != 0) {
+        return ret;
+    }
+    if (curl_multi_add_handle(multi->multi, session->curl) != CURLM_OK) {
+        transport_host_end(session, CURLE_ABORTED_BY_CALLBACK);
+        return TRANS_ERROR_CURL;
+    }
+
+    /* link into the pending list */
+    session->multi = multi;
+    session->prev = NULL;
+    session->next = multi->pending;
+    if (multi->pending != NULL) {
+        multi->pending->prev = session;
+    }
+    multi->pending = session;
+    multi->num_pending++;
+    return 0;
+}
+
+/**
+ * @brief Detaches a session from its multi handle.
+ *
+ * @param session transport session struct
+ */
+static void
+transport_detach(transport_session_t * session) {
+    transport_multi_t * multi = session->multi;
+
+    curl_multi_remove_handle(multi->multi, session->curl);
+    if (session->prev != NULL) {
+        session->prev->next = session->next;
+    } else {
+        multi->pending = session->next;
+    }
+    if (session->next != NULL) {
+        session->next->prev = session->prev;
+    }
+    session->prev = session->next = NULL;
+    session->multi = NULL;
+    multi->num_pending--;
+}
+
+/**
+ * @brief Collects finished transfers, fails over to the next host on curl
+ * errors and calls the completion callbacks.
+ *
+ * @param multi multi struct
+ */
+static void
+transport_dispatch(transport_multi_t * multi) {
+    transport_session_t * session;
+    CURLMsg * msg;
+    size_t host;
+    int left, ret;
+
+    while ((msg = curl_multi_info_read(multi->multi, &left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &session);
+        ret = msg->data.result;
+        transport_host_end(session, ret);
+
+        if (ret != CURLE_OK && transport_hosts_failover(session, &host)) {
+            /* try the next host */
+            curl_multi_remove_handle(multi->multi, session->curl);
+            if ((ret = transport_use_host(session, host, session->path)) == 0) {
+                if (curl_multi_add_handle(multi->multi, session->curl) == CURLM_OK) {
+                    continue;
+                }
+                transport_host_end(session, CURLE_ABORTED_BY_CALLBACK);
+                ret = TRANS_ERROR_CURL;
+            }
+        }
+
+        transport_write_release(session);
+        transport_detach(session);
+        if (ret == CURLE_OK && session->handler != NULL) {
+            ret = session->handler(session);
+        }
+        /* the callback may reuse the session for a new request */
+        session->callback(session, ret, session->userdata);
+    }
+}
+
+/**
+ * @brief Drives all asynchronous requests, waiting at most timeout
+ * milliseconds for network activity. Completion callbacks are called from
+ * within this function.
+ *
+ * @param multi multi struct
+ * @param timeout max wait in milliseconds, 0 to return immediately
+ *
+ * @return 0 on success or transport error code. The number of requests
+ * still in flight is multi->num_pending.
+ */
+static int
+transport_poll(transport_multi_t * multi, int timeout) {
+    int running = 0;
+
+    if (multi == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    if (curl_multi_perform(multi->multi, &running) != CURLM_OK) {
+        return TRANS_ERROR_CURL;
+    }
+    if (running > 0 && timeout > 0) {
+        if (curl_multi_wait(multi->multi, NULL, 0, timeout, NULL) != CURLM_OK) {
+            return TRANS_ERROR_CURL;
+        }
+        if (curl_multi_perform(multi->multi, &running) != CURLM_OK) {
+            return TRANS_ERROR_CURL;
+        }
+    }
+    transport_dispatch(multi);
+    return 0;
+}
+
+/**
+ * @brief curl socket callback, forwards socket interest to the event loop.
+ *
+ * @param easy curl easy handle
+ * @param fd socket
+ * @param what CURL_POLL_* value
+ * @param userp multi struct
+ * @param socketp per socket data, unused
+ *
+ * @return 0, or -1 on event loop errors.
+ */
+static int
+transport_multi_socket(CURL * easy, curl_socket_t fd, int what, void * userp, void * socketp) {
+    transport_multi_t * multi = (transport_multi_t *) userp;
+    return multi->socket_callback(fd, what, multi->userdata);
+}
+
+/**
+ * @brief curl timer callback, forwards the timeout to the event loop.
+ *
+ * @param cm curl multi handle
+ * @param timeout_ms timeout in milliseconds, -1 to remove the timer
+ * @param userp multi struct
+ *
+ * @return 0, or -1 on event loop errors.
+ */
+static int
+transport_multi_timer(CURLM * cm, long timeout_ms, void * userp) {
+    transport_multi_t * multi = (transport_multi_t * ) userp;
+    return multi->timer_callback(timeout_ms, multi->userdata);
+}
+
+/**
+ * @brief Hands the sockets and the timer of a multi handle over to an
+ * external event loop, which must call transport.socket_action when a
+ * socket is ready or the timer fires. transport.poll must not be used
+ * on the same handle afterwards.
+ *
+ * @param multi multi struct
+ * @param socket_callback called with the socket and TRANS_POLL_* to watch
+ * @param timer_callback called with the timeout in milliseconds
+ * @param userdata passed to both callbacks
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_multi_events(transport_multi_t * multi, transport_socket_callback_t socket_callback, transport_timer_callback_t timer_callback, void * userdata) {
+    if (multi == NULL || socket_callback == NULL || timer_callback == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    multi->socket_callback = socket_callback;
+    multi->timer_callback = timer_callback;
+    multi->userdata = userdata;
+
+    if (curl_multi_setopt(multi->multi, CURLMOPT_SOCKETFUNCTION, transport_multi_socket) != CURLM_OK ||
+            curl_multi_setopt(multi->multi, CURLMOPT_SOCKETDATA, multi) != CURLM_OK ||
+            curl_multi_setopt(multi->multi, CURLMOPT_TIMERFUNCTION, transport_multi_timer) != CURLM_OK ||
+            curl_multi_setopt(multi->multi, CURLMOPT_TIMERDATA, multi) != CURLM_OK) {
+        return TRANS_ERROR_CURL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Tells the multi handle that a socket is ready, or that the event
+ * loop timer fired, and calls the callbacks of completed requests. Never
+ * blocks.
+ *
+ * @param multi multi struct
+ * @param fd ready socket or TRANSPORT_SOCKET_TIMEOUT
+ * @param events TRANS_POLL_IN and/or TRANS_POLL_OUT, 0 for the timer
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_socket_action(transport_multi_t * multi, curl_socket_t fd, int events) {
+    int running = 0, mask = 0;
+
+    if (multi == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    if (events & TRANS_POLL_IN) {
+        mask |= CURL_CSELECT_IN;
+    }
+    if (events & TRANS_POLL_OUT) {
+        mask |= CURL_CSELECT_OUT;
+    }
+    if (curl_multi_socket_action(multi->multi, fd, mask, &running) != CURLM_OK) {
+        return TRANS_ERROR_CURL;
+    }
+    transport_dispatch(multi);
+    return 0;
+}
+
+/**
+ * @brief Cleanup multi struct. Requests still in flight are aborted without
+ * calling their callbacks.
+ *
+ * @param multi multi struct
+ */
+static void
+transport_multi_destroy(transport_multi_t * multi) {
+    if (multi == NULL) {
+        return;
+    }
+    while (multi->pending != NULL) {
+        transport_host_end(multi->pending, CURLE_ABORTED_BY_CALLBACK);
+        transport_write_release(multi->pending);
+        transport_detach(multi->pending);
+    }
+    curl_multi_cleanup(multi->multi);
+    free(multi);
+}
+
+/* Keys the streaming parsers care about, anything else is TRANS_KEY_OTHER */
+enum {
+    TRANS_KEY_NONE,
+    TRANS_KEY_OTHER,
+    TRANS_KEY_ARRAY,
+    TRANS_KEY_TOOK,
+    TRANS_KEY_TIMED_OUT,
+    TRANS_KEY_SHARDS,
+    TRANS_KEY_TOTAL,
+    TRANS_KEY_SUCCESSFUL,
+    TRANS_KEY_FAILED,
+    TRANS_KEY_HITS,
+    TRANS_KEY_MAX_SCORE,
+    TRANS_KEY_VALUE,
+    TRANS_KEY_INDEX,
+    TRANS_KEY_TYPE,
+    TRANS_KEY_ID,
+    TRANS_KEY_SCORE,
+    TRANS_KEY_SOURCE,
+    TRANS_KEY_ERROR,
+    TRANS_KEY_REASON,
+    TRANS_KEY_STATUS,
+    TRANS_KEY_SCROLL_ID,
+    TRANS_KEY_PIT_ID,
+    TRANS_KEY_SORT,
+    TRANS_KEY_RESPONSES,
+    TRANS_KEY_MAX
+};
+
+/* Paths of up to 4 keys packed into one integer, 5 bits per key */
+#define TRANS_PATH1(a) (a)
+#define TRANS_PATH2(a, b) (TRANS_PATH1(a) | (b) << 5)
+#define TRANS_PATH3(a, b, c) (TRANS_PATH2(a, b) | (c) << 10)
+#define TRANS_PATH4(a, b, c, d) (TRANS_PATH3(a, b, c) | (d) << 15)
+#define TRANS_PATH_DEPTH 4
+
+static const struct {
+    const char * name;
+    size_t len;
+    int key;
+} transport_keys[] = {
+    {"took", 4, TRANS_KEY_TOOK},
+    {"timed_out", 9, TRANS_KEY_TIMED_OUT},
+    {"_shards", 7, TRANS_KEY_SHARDS},
+    {"total", 5, TRANS_KEY_TOTAL},
+    {"successful", 10, TRANS_KEY_SUCCESSFUL},
+    {"failed", 6, TRANS_KEY_FAILED},
+    {"hits", 4, TRANS_KEY_HITS},
+    {"max_score", 9, TRANS_KEY_MAX_SCORE},
+    {"value", 5, TRANS_KEY_VALUE},
+    {"_index", 6, TRANS_KEY_INDEX},
+    {"_type", 5, TRANS_KEY_TYPE},
+    {"_id", 3, TRANS_KEY_ID},
+    {"_score", 6, TRANS_KEY_SCORE},
+    {"_source", 7, TRANS_KEY_SOURCE},
+    {"error", 5, TRANS_KEY_ERROR},
+    {"reason", 6, TRANS_KEY_REASON},
+    {"status", 6, TRANS_KEY_STATUS},
+    {"_scroll_id", 10, TRANS_KEY_SCROLL_ID},
+    {"pit_id", 6, TRANS_KEY_PIT_ID},
+    {"sort", 4, TRANS_KEY_SORT},
+    {"responses", 9, TRANS_KEY_RESPONSES},
+    {NULL, 0, TRANS_KEY_NONE}
+};
+
+/**
+ * @brief Maps a JSON object key to its TRANS_KEY_* value.
+ *
+ * @param key key, not zero terminated
+ * @param len length of key
+ *
+ * @return the key id or TRANS_KEY_OTHER.
+ */
+static int
+transport_parser_key(const unsigned char * key, size_t len) {
+    for (int i = 0; transport_keys[i].name != NULL; i++) {
+        if (transport_keys[i].len == len && memcmp(transport_keys[i].name, key, len) == 0) {
+            return transport_keys[i].key;
+        }
+    }
+    return TRANS_KEY_OTHER;
+}
+
+/**
+ * @brief Checks whether the parser is inside one of the search responses,
+ * the whole document for a search or an element of the responses array of
+ * a multi search.
+ *
+ * @param p parser
+ *
+ * @return non zero if it is.
+ */
+static int
+transport_parser_in_response(const transport_parser_t * p) {
+    return p->depth >= p->base &&
+        (p->base == 0 || (p->keys[0] == TRANS_KEY_RESPONSES && p->keys[1] == TRANS_KEY_ARRAY));
+}
+
+/**
+ * @brief Packs the keys leading from the search response to the current
+ * value into a TRANS_PATH* value.
+ *
+ * @param p parser
+ *
+ * @return the path, or 0 if the value is nested too deep to matter or is
+ * not part of a search response.
+ */
+static unsigned int
+transport_parser_path(const transport_parser_t * p) {
+    unsigned int path = 0;
+
+    if (p->depth > p->base + TRANS_PATH_DEPTH || !transport_parser_in_response(p)) {
+        return 0;
+    }
+    for (size_t i = p->base; i < p->depth; i++) {
+        path |= (unsigned int) p->keys[i] << (5 * (i - p->base));
+    }
+    return path;
+}
+
+/**
+ * @brief Enters a new object or array.
+ *
+ * @param p parser
+ * @param key TRANS_KEY_NONE for objects, TRANS_KEY_ARRAY for arrays
+ */
+static void
+transport_parser_push(transport_parser_t * p, int key) {
+    if (p->depth < TRANSPORT_PARSE_DEPTH) {
+        p->keys[p->depth] = key;
+    }
+    p->depth++;
+}
+
+/**
+ * @brief Copies a JSON string value into a fixed size, zero terminated field.
+ *
+ * @param dst destination, len + 1 bytes
+ * @param len max length
+ * @param str value, not zero terminated
+ * @param str_len length of value
+ */
+static void
+transport_parser_copy(char * dst, size_t len, const unsigned char * str, size_t str_len) {
+    if (str_len > len) {
+        str_len = len;
+    }
+    memcpy(dst, str, str_len);
+    dst[str_len] = '\0';
+}
+
+/**
+ * @brief Returns the offset in session->raw just past the token the
+ * parser is handling.
+ *
+ * @param session transport session struct
+ *
+ * @return offset in session->raw.
+ */
+static size_t
+transport_parser_offset(transport_session_t * session) {
+    return session->parser->chunk + yajl_get_bytes_consumed(session->parser->handle);
+}
+
+/**
+ * @brief Stores the location of the string value the parser is handling.
+ * The span covers the raw JSON between the quotes, escapes included.
+ *
+ * @param session transport session struct
+ * @param span destination
+ */
+static void
+transport_parser_string_span(transport_session_t * session, transport_span_t * span) {
+    const char * raw = session->raw.buffer;
+    size_t end = transport_parser_offset(session) - 1, start = end;
+
+    /* walk back to the opening quote, skipping escaped quotes */
+    while (start > 0) {
+        start--;
+        if (raw[start] == '"') {
+            size_t escapes = 0;
+            while (start - escapes > 0 && raw[start - escapes - 1] == '\\') {
+                escapes++;
+            }
+            if (escapes % 2 == 0) {
+                break;
+            }
+        }
+    }
+    span->offset = start + 1;
+    span->length = end - span->offset;
+}
+
+/**
+ * @brief Returns the hit the parser is in, if it is stored.
+ *
+ * @param session transport session struct
+ *
+ * @return the hit or NULL.
+ */
+static _hit_r *
+transport_search_hit(transport_session_t * session) {
+    transport_parser_t * p = session->parser;
+
+    if (p->error || p->hits == 0 || p->hits > p->result->hits.num_hits) {
+        return NULL;
+    }
+    return &p->result->hits.hits[p->hits - 1];
+}
+
+static int
+transport_search_null(void * ctx) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    if (session->parser->capture) {
+        return !session->parser->encode || yajl_gen_null(session->parser->gen) == yajl_gen_status_ok;
+    }
+    return 1;
+}
+
+static int
+transport_search_boolean(void * ctx, int value) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+
+    if (p->capture) {
+        return !p->encode || yajl_gen_bool(p->gen, value) == yajl_gen_status_ok;
+    }
+    if (transport_parser_path(p) == TRANS_PATH1(TRANS_KEY_TIMED_OUT) && !p->error) {
+        p->result->timed_out = value ? 1 : 0;
+    }
+    return 1;
+}
+
+static int
+transport_search_number(void * ctx, const char * value, size_t len) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+    char number[64];
+    _hit_r * hit;
+
+    if (p->capture) {
+        return !p->encode || yajl_gen_number(p->gen, value, len) == yajl_gen_status_ok;
+    }
+    transport_parser_copy(number, sizeof(number) - 1, (const unsigned char *) value, len);
+
+    switch (transport_parser_path(p)) {
+    case TRANS_PATH1(TRANS_KEY_STATUS):
+        p->status = atoi(number);
+        return 1;
+    }
+    if (p->error) {
+        return 1;
+    }
+    switch (transport_parser_path(p)) {
+    case TRANS_PATH1(TRANS_KEY_TOOK):
+        p->result->took = atoi(number);
+        break;
+    case TRANS_PATH2(TRANS_KEY_SHARDS, TRANS_KEY_TOTAL):
+        p->result->_shards.total = atoi(number);
+        break;
+    case TRANS_PATH2(TRANS_KEY_SHARDS, TRANS_KEY_SUCCESSFUL):
+        p->result->_shards.successful = atoi(number);
+        break;
+    case TRANS_PATH2(TRANS_KEY_SHARDS, TRANS_KEY_FAILED):
+        p->result->_shards.failed = atoi(number);
+        break;
+    case TRANS_PATH2(TRANS_KEY_HITS, TRANS_KEY_TOTAL):
+    /* newer elastic versions report {"value": n, "relation": "eq"} */
+    case TRANS_PATH3(TRANS_KEY_HITS, TRANS_KEY_TOTAL, TRANS_KEY_VALUE):
+        p->result->hits.total = atoi(number);
+        break;
+    case TRANS_PATH2(TRANS_KEY_HITS, TRANS_KEY_MAX_SCORE):
+        p->result->hits.max_score = strtod(number, NULL);
+        break;
+    case TRANS_PATH4(TRANS_KEY_HITS, TRANS_KEY_HITS, TRANS_KEY_ARRAY, TRANS_KEY_SCORE):
+        if ((hit = transport_search_hit(session)) != NULL) {
+            hit->_score = strtod(number, NULL);
+        }
+        break;
+    }
+    return 1;
+}
+
+static int
+transport_search_string(void * ctx, const unsigned char * value, size_t len) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+    _hit_r * hit;
+
+    if (p->capture) {
+        return !p->encode || yajl_gen_string(p->gen, value, len) == yajl_gen_status_ok;
+    }
+
+    switch (transport_parser_path(p)) {
+    case TRANS_PATH1(TRANS_KEY_ERROR):
+    case TRANS_PATH2(TRANS_KEY_ERROR, TRANS_KEY_REASON):
+        transport_parser_copy(p->err->error, sizeof (p->err->error) - 1, value, len);
+        p->error = 1;
+        break;
+    case TRANS_PATH1(TRANS_KEY_SCROLL_ID):
+        transport_parser_string_span(session, &p->result->_scroll_id_span);
+        break;
+    case TRANS_PATH1(TRANS_KEY_PIT_ID):
+        transport_parser_string_span(session, &p->result->pit_id_span);
+        break;
+    case TRANS_PATH4(TRANS_KEY_HITS, TRANS_KEY_HITS, TRANS_KEY_ARRAY, TRANS_KEY_INDEX):
+        if ((hit = transport_search_hit(session)) != NULL) {
+            if ((hit->_index = transport_arena_strndup(session, (const char *) value, len)) == NULL) {
+                return 0;
+            }
+            transport_parser_string_span(session, &hit->_index_span);
+        }
+        break;
+    case TRANS_PATH4(TRANS_KEY_HITS, TRANS_KEY_HITS, TRANS_KEY_ARRAY, TRANS_KEY_TYPE):
+        if ((hit = transport_search_hit(session)) != NULL) {
+            if ((hit->_type = transport_arena_strndup(session, (const char *) value, len)) == NULL) {
+                return 0;
+            }
+        }
+        break;
+    case TRANS_PATH4(TRANS_KEY_HITS, TRANS_KEY_HITS, TRANS_KEY_ARRAY, TRANS_KEY_ID):
+        if ((hit = transport_search_hit(session)) != NULL) {
+            if ((hit->_id = transport_arena_strndup(session, (const char *) value, len)) == NULL) {
+                return 0;
+            }
+            transport_parser_string_span(session, &hit->_id_span);
+        }
+        break;
+    }
+    return 1;
+}
+
+static int
+transport_search_start_map(void * ctx) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+    _hit_r * hit;
+
+    if (p->capture) {
+        transport_parser_push(p, TRANS_KEY_NONE);
+        return !p->encode || yajl_gen_map_open(p->gen) == yajl_gen_status_ok;
+    }
+
+    if (p->depth == p->base && p->result != NULL) {
+        p->result->took = 0;
+        p->result->timed_out = 0;
+        p->result->_shards.total = 0;
+        p->result->_shards.successful = 0;
+        p->result->_shards.failed = 0;
+        p->result->hits.total = 0;
+        p->result->hits.max_score = 0;
+        p->result->hits.num_hits = 0;
+        p->result->hits.hits = NULL;
+        memset(&p->result->_scroll_id_span, 0, sizeof (transport_span_t));
+        memset(&p->result->pit_id_span, 0, sizeof (transport_span_t));
+    }
+
+    switch (transport_parser_path(p)) {
+    case TRANS_PATH1(TRANS_KEY_ERROR):
+        p->error = 1;
+        break;
+    case TRANS_PATH3(TRANS_KEY_HITS, TRANS_KEY_HITS, TRANS_KEY_ARRAY):
+        p->hits++;
+        if (p->error || (session->max_hits > 0 && p->hits > session->max_hits)) {
+            break;
+        }
+        /* the hits array lives in the arena and grows as hits arrive */
+        if (p->hits > p->hits_size) {
+            size_t size = p->hits_size ? p->hits_size * 2 : 16;
+            if ((hit = transport_arena_realloc(session, p->result->hits.hits, size * sizeof (_hit_r))) == NULL) {
+                return 0;
+            }
+            p->result->hits.hits = hit;
+            p->hits_size = size;
+        }
+        memset(&p->result->hits.hits[p->hits - 1], 0, sizeof (_hit_r));
+        p->result->hits.num_hits = p->hits;
+        break;
+    case TRANS_PATH4(TRANS_KEY_HITS, TRANS_KEY_HITS, TRANS_KEY_ARRAY, TRANS_KEY_SOURCE):
+        if ((hit = transport_search_hit(session)) != NULL) {
+            hit->_source_span.offset = transport_parser_offset(session) - 1;
+            transport_parser_push(p, TRANS_KEY_NONE);
+            p->capture = p->depth;
+            p->encode = !(session->options & TRANS_OPTION_ZERO_COPY);
+            return !p->encode || yajl_gen_map_open(p->gen) == yajl_gen_status_ok;
+        }
+        break;
+    }
+    transport_parser_push(p, TRANS_KEY_NONE);
+    return 1;
+}
+
+static int
+transport_search_map_key(void * ctx, const unsigned char * key, size_t len) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+
+    if (p->capture) {
+        return !p->encode || yajl_gen_string(p->gen, key, len) == yajl_gen_status_ok;
+    }
+    if (p->depth > 0 && p->depth <= p->base + TRANS_PATH_DEPTH) {
+        p->keys[p->depth - 1] = transport_parser_key(key, len);
+    }
+    return 1;
+}
+
+static int
+transport_search_end_map(void * ctx) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+    const unsigned char * buf;
+    size_t len;
+    _hit_r * hit;
+
+    if (p->capture) {
+        if (p->encode && yajl_gen_map_close(p->gen) != yajl_gen_status_ok) {
+            return 0;
+        }
+        /* the _source object is complete, store it in the hit */
+        if (p->depth == p->capture) {
+            if ((hit = transport_search_hit(session)) != NULL) {
+                hit->_source_span.length = transport_parser_offset(session) - hit->_source_span.offset;
+                if (p->encode && yajl_gen_get_buf(p->gen, &buf, &len) == yajl_gen_status_ok) {
+                    if ((hit->_source = transport_arena_strndup(session, (const char *) buf, len)) == NULL) {
+                        return 0;
+                    }
+                }
+            }
+            if (p->encode) {
+                yajl_gen_clear(p->gen);
+                yajl_gen_reset(p->gen, NULL);
+            }
+            p->capture = 0;
+        }
+    }
+    p->depth--;
+    return 1;
+}
+
+static int
+transport_search_start_array(void * ctx) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+    _hit_r * hit;
+
+    if (p->capture) {
+        transport_parser_push(p, TRANS_KEY_ARRAY);
+        return !p->encode || yajl_gen_array_open(p->gen) == yajl_gen_status_ok;
+    }
+    /* the sort values of a hit are only located, never copied */
+    if (transport_parser_path(p) == TRANS_PATH4(TRANS_KEY_HITS, TRANS_KEY_HITS, TRANS_KEY_ARRAY, TRANS_KEY_SORT) &&
+            (hit = transport_search_hit(session)) != NULL) {
+        hit->sort_span.offset = transport_parser_offset(session) - 1;
+        transport_parser_push(p, TRANS_KEY_ARRAY);
+        p->capture = p->depth;
+        p->encode = 0;
+        return 1;
+    }
+    transport_parser_push(p, TRANS_KEY_ARRAY);
+    return 1;
+}
+
+static int
+transport_search_end_array(void * ctx) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+    _hit_r * hit;
+
+    if (p->capture) {
+        if (p->encode && yajl_gen_array_close(p->gen) != yajl_gen_status_ok) {
+            return 0;
+        }
+        /* the sort array is complete */
+        if (p->depth == p->capture) {
+            if ((hit = transport_search_hit(session)) != NULL) {
+                hit->sort_span.length = transport_parser_offset(session) - hit->sort_span.offset;
+            }
+            p->capture = 0;
+        }
+    }
+    p->depth--;
+    return 1;
+}
+
+static const yajl_callbacks transport_search_callbacks = {
+    transport_search_null,
+    transport_search_boolean,
+    NULL,
+    NULL,
+    transport_search_number,
+    transport_search_string,
+    transport_search_start_map,
+    transport_search_map_key,
+    transport_search_end_map,
+    transport_search_start_array,
+    transport_search_end_array
+};
+
+/**
+ * @brief Starts an object of a multi search response. The responses array
+ * holds one search response per query, each is parsed by the search
+ * callbacks into its own slot of session->msearch.
+ */
+static int
+transport_msearch_start_map(void * ctx) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+    _msearch_item_r * items;
+
+    if (!p->capture && p->depth == 0) {
+        p->base = 2;
+        p->result = NULL;
+        session->msearch.num_responses = 0;
+        session->msearch.responses = NULL;
+    } else if (!p->capture && p->depth == p->base && transport_parser_in_response(p)) {
+        /* the responses array lives in the arena and grows as responses arrive */
+        if (session->msearch.num_responses == p->responses_size) {
+            size_t size = p->responses_size ? p->responses_size * 2 : 16;
+            if ((items = transport_arena_realloc(session, session->msearch.responses, size * sizeof (_msearch_item_r))) == NULL) {
+                return 0;
+            }
+            session->msearch.responses = items;
+            p->responses_size = size;
+        }
+        items = &session->msearch.responses[session->msearch.num_responses++];
+        memset(items, 0, sizeof (_msearch_item_r));
+        p->result = &items->search;
+        p->err = &items->error;
+        p->hits = 0;
+        p->hits_size = 0;
+        p->error = 0;
+        p->status = 0;
+    }
+    return transport_search_start_map(ctx);
+}
+
+/**
+ * @brief Ends an object of a multi search response, storing the status of
+ * a failed query in its slot.
+ */
+static int
+transport_msearch_end_map(void * ctx) {
+    transport_session_t * session = (transport_session_t *) ctx;
+    transport_parser_t * p = session->parser;
+
+    if (!p->capture && p->depth == p->base + 1 && p->result != NULL && transport_parser_in_response(p)) {
+        p->err->status = p->error ? p->status : 0;
+        p->result = NULL;
+    }
+    return transport_search_end_map(ctx);
+}
+
+static const yajl_callbacks transport_msearch_callbacks = {
+    transport_search_null,
+    transport_search_boolean,
+    NULL,
+    NULL,
+    transport_search_number,
+    transport_search_string,
+    transport_msearch_start_map,
+    transport_search_map_key,
+    transport_msearch_end_map,
+    transport_search_start_array,
+    transport_search_end_array
+};
+
+/**
+ * @brief Prepares the session's streaming parser for a new response.
+ *
+ * @param session transport session struct
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_stream_reset(transport_session_t * session) {
+    transport_parser_t * p = session->parser;
+
+    yajl_alloc_funcs afs = transport_yajl_alloc_funcs(session);
+
+    if (p == NULL) {
+        if ((p = calloc(1, sizeof (transport_parser_t))) == NULL) {
+            return TRANS_ERROR_MEMORY;
+        }
+        session->allocs++;
+        session->parser = p;
+    }
+    if (p->gen == NULL && (p->gen = yajl_gen_alloc(&afs)) == NULL) {
+        return TRANS_ERROR_MEMORY;
+    }
+    /* yajl handles can not be reset, the old one stays in the arena */
+    if ((p->handle = yajl_alloc(session->stream, &afs, session)) == NULL) {
+        return TRANS_ERROR_MEMORY;
+    }
+    yajl_gen_clear(p->gen);
+    yajl_gen_reset(p->gen, NULL);
+    p->consumed = 0;
+    p->chunk = 0;
+    p->failed = 0;
+    p->depth = 0;
+    p->capture = 0;
+    p->encode = 0;
+    p->hits = 0;
+    p->hits_size = 0;
+    p->error = 0;
+    p->status = 0;
+    p->base = 0;
+    p->result = &session->search;
+    p->err = &session->error;
+    p->responses_size = 0;
+    return 0;
+}
+
+/**
+ * @brief Feeds the part of the response not yet seen by the streaming
+ * parser to it.
+ *
+ * @param session transport session struct
+ */
+static void
+transport_stream_feed(transport_session_t * session) {
+    transport_parser_t * p = session->parser;
+
+    if (p == NULL || p->handle == NULL || p->failed || p->consumed >= session->raw.pos) {
+        return;
+    }
+    p->chunk = p->consumed;
+    if (yajl_parse(p->handle, (const unsigned char *) &session->raw.buffer[p->consumed], session->raw.pos - p->consumed) != yajl_status_ok) {
+        p->failed = 1;
+    }
+    p->consumed = session->raw.pos;
+}
+
+/**
+ * @brief Completes parsing a response with the streaming parser. Parts of
+ * the response that have not been streamed, if any, are parsed first.
+ *
+ * @param session transport session struct
+ * @param stream parser callbacks
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_stream_finish(transport_session_t * session, const yajl_callbacks * stream) {
+    transport_parser_t * p = session->parser;
+    int ret;
+
+    if (session->stream != stream || p == NULL || p->handle == NULL) {
+        session->stream = stream;
+        if ((ret = transport_stream_reset(session)) != 0) {
+            return ret;
+        }
+        p = session->parser;
+    }
+    transport_stream_feed(session);
+    if (p->failed || yajl_complete_parse(p->handle) != yajl_status_ok) {
+        return TRANS_ERROR_PARSE;
+    }
+    return 0;
+}
+
+/**
+ * @brief Performs an elastic search.
+ *
+ * On a successfull search a pointer to the raw respose is stored in
+ * session->raw.buffer and the size in session->raw.pos.
+ *
+ * @param session transport session struct.
+ * @param index elastic index
+ * @param type elastic typ
+ * @param payload HTTP POST body
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_search(transport_session_t * session, const char * index, const char * type, const char * payload) {
+    char path[TRANSPORT_CALL_URL_LEN];
+    int ret = 0;
+
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, type, "_search", path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    ret = transport_call_hedged(session, path, TRANS_METHOD_POST, payload, &transport_search_callbacks);
+    if (ret != 0) {
+        return ret;
+    }
+    return transport_search_response(session);
+}
+
+/**
+ * @brief Starts an asynchronous elastic search, the result is parsed into
+ * session->search before callback is called.
+ *
+ * @param multi multi struct
+ * @param session transport session struct.
+ * @param index elastic index
+ * @param type elastic type
+ * @param payload HTTP POST body
+ * @param callback completion callback
+ * @param userdata passed to callback
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_async_search(transport_multi_t * multi, transport_session_t * session, const char * index, const char * type, const char * payload,
+        transport_callback_t callback, void * userdata) {
+    char path[TRANSPORT_CALL_URL_LEN];
+
+    if (session == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, type, "_search", path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    return transport_submit(multi, session, path, TRANS_METHOD_POST, payload, &transport_search_callbacks, transport_search_response, callback, userdata);
+}
+
+/**
+ * @brief Completes parsing the response of an elastic search into
+ * session->search. Most of the response has normally been parsed while it
+ * was received.
+ *
+ * @param session transport session struct.
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_search_response(transport_session_t * session) {
+    int ret = 0;
+
+    if ((ret = transport_stream_finish(session, &transport_search_callbacks)) != 0) {
+        return ret;
+    }
+
+    /* store error and status, if any, in document response */
+    if (session->parser->error) {
+        session->error.status = session->parser->status;
+        session->type = TRANS_SESSION_TYPE_ERROR;
+        return TRANS_ERROR_ELASTIC;
+    }
+    session->type = TRANS_SESSION_TYPE_SEARCH;
+    return ret;
+}
+
+/**
+ * @brief Performs several searches in one _msearch request. The result of
+ * queries[i] is parsed into session->msearch.responses[i], a query that
+ * failed has the HTTP status and reason in its error, the others succeed
+ * independently.
+ *
+ * @param session transport session struct.
+ * @param queries index, type and search body of every query. The bodies
+ * must be on a single line.
+ * @param num_queries number of queries
+ *
+ * @return 0 if the request succeeded, even if single queries failed, or
+ * transport error code.
+ */
+static int
+transport_msearch(transport_session_t * session, const transport_msearch_query_t * queries, size_t num_queries) {
+    buf_t body = {NULL, 0, 0};
+    int ret = 0;
+
+    if (session == NULL || queries == NULL || num_queries == 0) {
+        return TRANS_ERROR_INPUT;
+    }
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    /* one header line and one body line per query */
+    for (size_t i = 0; i < num_queries && ret == 0; i++) {
+        const transport_msearch_query_t * q = &queries[i];
+
+        ret |= transport_buf_append(&body, "{", 1);
+        if (q->index != NULL && q->index[0] != '\0') {
+            ret |= transport_buf_append(&body, "\"index\":", 8);
+            ret |= transport_buf_append_json_string(&body, q->index);
+            if (q->type != NULL && q->type[0] != '\0') {
+                ret |= transport_buf_append(&body, ",\"type\":", 8);
+                ret |= transport_buf_append_json_string(&body, q->type);
+            }
+        }
+        ret |= transport_buf_append(&body, "}\n", 2);
+        ret |= transport_buf_append(&body, q->query != NULL ? q->query : "{}", q->query != NULL ? strlen(q->query) : 2);
+        ret |= transport_buf_append(&body, "\n", 1);
+    }
+    if (ret != 0) {
+        transport_buf_free(&body);
+        return TRANS_ERROR_MEMORY;
+    }
+
+    ret = transport_call_hedged(session, "_msearch", TRANS_METHOD_POST, body.buffer, &transport_msearch_callbacks);
+    transport_buf_free(&body);
+    if (ret != 0) {
+        return ret;
+    }
+    return transport_msearch_response(session);
+}
+
+/**
+ * @brief Completes parsing the response of a multi search into
+ * session->msearch.
+ *
+ * @param session transport session struct.
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_msearch_response(transport_session_t * session) {
+    yajl_val node;
+    int ret = 0;
+
+    if ((ret = transport_stream_finish(session, &transport_msearch_callbacks)) != 0) {
+        return ret;
+    }
+
+    /* the request as a whole failed, there are no responses */
+    if (session->status >= 300 || session->parser->base == 0) {
+        if ((node = transport_tree_parse(session)) == NULL) {
+            return TRANS_ERROR_PARSE;
+        }
+        return transport_response_error(session, node);
+    }
+    session->type = TRANS_SESSION_TYPE_MSEARCH;
+    return ret;
+}
+
+/**
+ * @brief Stores the error of a failed request, its HTTP status and the
+ * reason from the error member of its response, an object or a string.
+ *
+ * @param session transport session struct.
+ * @param node parsed response, NULL if there is none
+ *
+ * @return TRANS_ERROR_ELASTIC
+ */
+static int
+transport_response_error(transport_session_t * session, yajl_val node) {
+    const char * reason_path[] = {"error", "reason", NULL},
+               * error_path[] = {"error", NULL};
+    long status = session->status;
+    yajl_val v;
+
+    session->error.error[0] = '\0';
+    if (node != NULL && ((v = yajl_tree_get(node, reason_path, yajl_t_string)) != NULL ||
+            (v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL)) {
+        strncpy(session->error.error, YAJL_GET_STRING(v), sizeof (session->error.error) - 1);
+        session->error.error[sizeof (session->error.error) - 1] = '\0';
+    }
+    session->error.status = status;
+    session->type = TRANS_SESSION_TYPE_ERROR;
+    return TRANS_ERROR_ELASTIC;
+}
+
+/**
+ * @brief Decides whether a write succeeded from its HTTP status alone, for
+ * sessions with TRANS_OPTION_STATUS_ONLY. The body of a 2xx response is not
+ * parsed, any other status is an error.
+ *
+ * @param session transport session struct.
+ *
+ * @return 0 on a 2xx status or TRANS_ERROR_ELASTIC.
+ */
+static int
+transport_status_only(transport_session_t * session) {
+    if (session->status >= 200 && session->status < 300) {
+        return 0;
+    }
+    return transport_response_error(session, transport_tree_parse(session));
+}
+
+/**
+ * @brief Creates a new elastic index.
+ *
+ * @param session transport session struct.
+ * @param index elastic index
+ * @aram payload HTTP PUT body
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_create_index(transport_session_t * session, const char * index, const char * payload) {
+    char path[TRANSPORT_CALL_URL_LEN];
+    int ret = 0;
+
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, NULL, NULL, path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    ret = transport_http_put(session, path, payload);
+    if (ret != 0) {
+        return ret;
+    }
+    return transport_create_index_response(session);
+}
+
+/**
+ * @brief Parses the response of a create index request.
+ *
+ * @param session transport session struct.
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_create_index_response(transport_session_t * session) {
+    const char * acknowledged_path[] = {"acknowledged", NULL},
+           * status_path[] = {"status", NULL},
+           * error_path[] = {"error", NULL};
+    yajl_val node, v;
+    int ret = 0;
+
+    /* the HTTP status is enough */
+    if (session->options & TRANS_OPTION_STATUS_ONLY) {
+        return transport_status_only(session);
+    }
+
+    /* parse response */
+    node = transport_tree_parse(session);
+    if (node == NULL) {
+        return TRANS_ERROR_PARSE;
+    }
+
+    /* store error and status, if any, in document response */
+    if ((v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
+        ret = TRANS_ERROR_ELASTIC;
+        strncpy(session->error.error, YAJL_GET_STRING(v), TRANSPORT_ERROR_LEN);
+        if ((v = yajl_tree_get(node, status_path, yajl_t_number)) != NULL) {
+            session->error.status = atoi(YAJL_GET_NUMBER(v));
+        }
+        session->type = TRANS_SESSION_TYPE_ERROR;
+    } else {
+        if ((v = yajl_tree_get(node, acknowledged_path, yajl_t_true)) != NULL) {
+            session->create_index.acknowledged = YAJL_IS_TRUE(v) ? 1 : 0;
+        }
+        session->type = TRANS_SESSION_TYPE_CREATE_INDEX;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Deletes an elastic index.
+ *
+ * @param session transport session struct.
+ * @param index elastic index
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_delete_index(transport_session_t * session, const char * index) {
+    char path[TRANSPORT_CALL_URL_LEN];
+    int ret = 0;
+
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, NULL, NULL, path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    ret = transport_http_delete(session, path, NULL);
+    if (ret != 0) {
+        return ret;
+    }
+    return transport_delete_index_response(session);
+}
+
+/**
+ * @brief Parses the response of a delete index request.
+ *
+ * @param session transport session struct.
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_delete_index_response(transport_session_t * session) {
+    const char * acknowledged_path[] = {"acknowledged", NULL},
+           * status_path[] = {"status", NULL},
+           * error_path[] = {"error", NULL};
+    yajl_val node, v;
+    int ret = 0;
+
+    /* the HTTP status is enough */
+    if (session->options & TRANS_OPTION_STATUS_ONLY) {
+        return transport_status_only(session);
+    }
+
+    /* parse response */
+    node = transport_tree_parse(session);
+    if (node == NULL) {
+        return TRANS_ERROR_PARSE;
+    }
+
+    /* store error and status, if any, in document response */
+    if ((v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
+        ret = TRANS_ERROR_ELASTIC;
+        strncpy(session->error.error, YAJL_GET_STRING(v), TRANSPORT_ERROR_LEN);
+        if ((v = yajl_tree_get(node, status_path, yajl_t_number)) != NULL) {
+            session->error.status = atoi(YAJL_GET_NUMBER(v));
+        }
+        session->type = TRANS_SESSION_TYPE_ERROR;
+    } else {
+        if ((v = yajl_tree_get(node, acknowledged_path, yajl_t_true)) != NULL) {
+            session->delete_index.acknowledged = YAJL_IS_TRUE(v) ? 1 : 0;
+        }
+        session->type = TRANS_SESSION_TYPE_DELETE_INDEX;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Stores a new document in elastic.
+ *
+ * @param session transport session struct.
+ * @param index elastic index
+ * @param type elastic type
+ * @param id document id
+ * @param payload HTTP PUT body
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_index_document(transport_session_t * session, const char * index, const char * type, const char * id, const char * payload) {
+    char path[TRANSPORT_CALL_URL_LEN];
+    int ret = 0;
+
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, type, id, path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    ret = transport_call_write(session, path, TRANS_METHOD_PUT, payload);
+    if (ret != 0) {
+        return ret;
+    }
+    return transport_index_document_response(session);
+}
+
+/**
+ * @brief Starts storing a new document in elastic asynchronously, the
+ * result is parsed into session->index_document before callback is called.
+ *
+ * @param multi multi struct
+ * @param session transport session struct.
+ * @param index elastic index
+ * @param type elastic type
+ * @param id document id
+ * @param payload HTTP PUT body
+ * @param callback completion callback
+ * @param userdata passed to callback
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_async_index_document(transport_multi_t * multi, transport_session_t * session, const char * index, const char * type, const char * id,
+        const char * payload, transport_callback_t callback, void * userdata) {
+    char path[TRANSPORT_CALL_URL_LEN];
+    int ret;
+
+    if (session == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, type, id, path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    if (session->multi != NULL) {
+        return TRANS_ERROR_BUSY;
+    }
+    if ((ret = transport_write_acquire(session, 0)) != 0) {
+        return ret;
+    }
+    if ((ret = transport_submit(multi, session, path, TRANS_METHOD_PUT, payload, NULL, transport_index_document_response, callback, userdata)) != 0) {
+        transport_write_release(session);
+    }
+    return ret;
+}
+
+/**
+ * @brief Parses the response of an index document request.
+ *
+ * @param session transport session struct.
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_index_document_response(transport_session_t * session) {
+    const char * index_path[] = {"_index", NULL},
+               * type_path[] = {"_type", NULL},
+               * id_path[] = {"_id", NULL},
+               * version_path[] = {"_version", NULL},
+               * created_path[] = {"created", NULL},
+               * status_path[] = {"status", NULL},
+               * error_path[] = {"error", NULL};
+    yajl_val node, v;
+    int ret = 0;
+
+    /* the HTTP status is enough */
+    if (session->options & TRANS_OPTION_STATUS_ONLY) {
+        return transport_status_only(session);
+    }
+
+    /* parse response */
+    node = transport_tree_parse(session);
+    if (node == NULL) {
+        return TRANS_ERROR_PARSE;
+    }
+
+    /* store error and status, if any, in document response */
+    if ((v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
+        ret = TRANS_ERROR_ELASTIC;
+        strncpy(session->error.error, YAJL_GET_STRING(v), TRANSPORT_ERROR_LEN);
+        if ((v = yajl_tree_get(node, status_path, yajl_t_number)) != NULL) {
+            session->error.status = atoi(YAJL_GET_NUMBER(v));
+        }
+        session->type = TRANS_SESSION_TYPE_ERROR;
+    } else {
+        /* store index in document response */
+        if ((v = yajl_tree_get(node, index_path, yajl_t_string)) != NULL) {
+            strncpy(session->index_document._index, YAJL_GET_STRING(v), TRANSPORT_INDEX_LEN);
+        }
+        /* store type in document response */
+        if ((v = yajl_tree_get(node, type_path, yajl_t_string)) != NULL) {
+            strncpy(session->index_document._type, YAJL_GET_STRING(v), TRANSPORT_TYPE_LEN);
+        }
+        /* store id in document response */
+        if ((v = yajl_tree_get(node, id_path, yajl_t_string)) != NULL) {
+            strncpy(session->index_document._id, YAJL_GET_STRING(v), TRANSPORT_ID_LEN);
+        }
+        /* store version in document response */
+        if ((v = yajl_tree_get(node, version_path, yajl_t_number)) != NULL) {
+            session->index_document._version = atoi(YAJL_GET_NUMBER(v));
+        }
+        /* store created in document response */
+        if ((v = yajl_tree_get(node, created_path, yajl_t_true)) != NULL) {
+            session->index_document.created = YAJL_IS_TRUE(v) ? 1 : 0;
+        }
+        session->type = TRANS_SESSION_TYPE_INDEX_DOCUMENT;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Encodes a parsed JSON value.
+ *
+ * @param gen generator
+ * @param v value
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int
+transport_tree_encode(yajl_gen gen, yajl_val v) {
+    yajl_gen_status status = yajl_gen_status_ok;
+
+    switch (v->type) {
+    case yajl_t_string:
+        status = yajl_gen_string(gen, (const unsigned char *) v->u.string, strlen(v->u.string));
+        break;
+    case yajl_t_number:
+        status = yajl_gen_number(gen, v->u.number.r, strlen(v->u.number.r));
+        break;
+    case yajl_t_object:
+        status = yajl_gen_map_open(gen);
+        for (size_t i = 0; i < v->u.object.len && status == yajl_gen_status_ok; i++) {
+            const char * key = v->u.object.keys[i];
+            status = yajl_gen_string(gen, (const unsigned char *) key, strlen(key));
+            if (status == yajl_gen_status_ok && transport_tree_encode(gen, v->u.object.values[i]) != 0) {
+                return -1;
+            }
+        }
+        if (status == yajl_gen_status_ok) {
+            status = yajl_gen_map_close(gen);
+        }
+        break;
+    case yajl_t_array:
+        status = yajl_gen_array_open(gen);
+        for (size_t i = 0; i < v->u.array.len && status == yajl_gen_status_ok; i++) {
+            if (transport_tree_encode(gen, v->u.array.values[i]) != 0) {
+                return -1;
+            }
+        }
+        if (status == yajl_gen_status_ok) {
+            status = yajl_gen_array_close(gen);
+        }
+        break;
+    case yajl_t_true:
+    case yajl_t_false:
+        status = yajl_gen_bool(gen, v->type == yajl_t_true);
+        break;
+    default:
+        status = yajl_gen_null(gen);
+        break;
+    }
+    return status == yajl_gen_status_ok ? 0 : -1;
+}
+
+/**
+ * @brief Stores a document of a get or multi get response.
+ *
+ * @param session transport session struct.
+ * @param node the document
+ * @param doc destination
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_get_doc(transport_session_t * session, yajl_val node, _get_r * doc) {
+    const char * index_path[] = {"_index", NULL},
+               * type_path[] = {"_type", NULL},
+               * id_path[] = {"_id", NULL},
+               * version_path[] = {"_version", NULL},
+               * found_path[] = {"found", NULL},
+               * source_path[] = {"_source", NULL},
+               * reason_path[] = {"error", "reason", NULL},
+               * error_path[] = {"error", NULL};
+    yajl_alloc_funcs afs = transport_yajl_alloc_funcs(session);
+    const unsigned char * buf;
+    yajl_gen gen;
+    yajl_val v;
+    size_t len;
+
+    memset(doc, 0, sizeof (_get_r));
+    if ((v = yajl_tree_get(node, index_path, yajl_t_string)) != NULL) {
+        doc->_index = YAJL_GET_STRING(v);
+    }
+    if ((v = yajl_tree_get(node, type_path, yajl_t_string)) != NULL) {
+        doc->_type = YAJL_GET_STRING(v);
+    }
+    if ((v = yajl_tree_get(node, id_path, yajl_t_string)) != NULL) {
+        doc->_id = YAJL_GET_STRING(v);
+    }
+    if ((v = yajl_tree_get(node, version_path, yajl_t_number)) != NULL) {
+        doc->_version = atoi(YAJL_GET_NUMBER(v));
+    }
+    if ((v = yajl_tree_get(node, found_path, yajl_t_any)) != NULL) {
+        doc->found = YAJL_IS_TRUE(v) ? 1 : 0;
+    }
+    if ((v = yajl_tree_get(node, reason_path, yajl_t_string)) != NULL ||
+            (v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
+        doc->error = YAJL_GET_STRING(v);
+    }
+
+    /* re-encode the document, the generator lives in the arena */
+    if ((v = yajl_tree_get(node, source_path, yajl_t_any)) != NULL) {
+        if ((gen = yajl_gen_alloc(&afs)) == NULL) {
+            return TRANS_ERROR_MEMORY;
+        }
+        if (transport_tree_encode(gen, v) != 0 || yajl_gen_get_buf(gen, &buf, &len) != yajl_gen_status_ok ||
+                (doc->_source = transport_arena_strndup(session, (const char *) buf, len)) == NULL) {
+            return TRANS_ERROR_MEMORY;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Fetches a document by id. This is a real time lookup on a single
+ * shard, unlike a search for the id.
+ *
+ * @param session transport session struct.
+ * @param index elastic index
+ * @param type elastic type, NULL for _doc
+ * @param id document id
+ *
+ * @return 0 on success or transport error code. A missing document is not
+ * an error, session->get.found is 0 then.
+ */
+static int
+transport_get(transport_session_t * session, const char * index, const char * type, const char * id) {
+    const char * error_path[] = {"error", NULL};
+    char path[TRANSPORT_CALL_URL_LEN];
+    yajl_val node;
+    int ret = 0;
+
+    if (session == NULL || id == NULL || id[0] == '\0') {
+        return TRANS_ERROR_INPUT;
+    }
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, type != NULL && type[0] != '\0' ? type : "_doc", id, path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    if ((ret = transport_call_hedged(session, path, TRANS_METHOD_GET, NULL, NULL)) != 0) {
+        return ret;
+    }
+    if ((node = transport_tree_parse(session)) == NULL) {
+        return TRANS_ERROR_PARSE;
+    }
+    /* a missing document is a 404 without an error */
+    if ((session->status >= 300 && session->status != 404) || yajl_tree_get(node, error_path, yajl_t_any) != NULL) {
+        return transport_response_error(session, node);
+    }
+    if ((ret = transport_get_doc(session, node, &session->get)) != 0) {
+        return ret;
+    }
+    session->type = TRANS_SESSION_TYPE_GET;
+    return 0;
+}
+
+/**
+ * @brief Fetches several documents of an index by id in one request.
+ *
+ * @param session transport session struct.
+ * @param index elastic index
+ * @param type elastic type, or NULL
+ * @param ids document ids
+ * @param num_ids number of ids
+ *
+ * @return 0 on success or transport error code. session->mget.docs[i] is
+ * the document of ids[i], with found set to 0 if it is missing and error
+ * set if it could not be fetched.
+ */
+static int
+transport_mget(transport_session_t * session, const char * index, const char * type, const char * const * ids, size_t num_ids) {
+    const char * docs_path[] = {"docs", NULL};
+    char path[TRANSPORT_CALL_URL_LEN];
+    buf_t body = {NULL, 0, 0};
+    yajl_val node, docs;
+    int ret = 0;
+
+    if (session == NULL || ids == NULL || num_ids == 0) {
+        return TRANS_ERROR_INPUT;
+    }
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, type, "_mget", path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    ret |= transport_buf_append(&body, "{\"ids\":[", 8);
+    for (size_t i = 0; i < num_ids && ret == 0; i++) {
+        if (i > 0) {
+            ret |= transport_buf_append(&body, ",", 1);
+        }
+        ret |= transport_buf_append_json_string(&body, ids[i] != NULL ? ids[i] : "");
+    }
+    ret |= transport_buf_append(&body, "]}", 2);
+    if (ret != 0) {
+        transport_buf_free(&body);
+        return TRANS_ERROR_MEMORY;
+    }
+
+    ret = transport_call_hedged(session, path, TRANS_METHOD_POST, body.buffer, NULL);
+    transport_buf_free(&body);
+    if (ret != 0) {
+        return ret;
+    }
+    if ((node = transport_tree_parse(session)) == NULL) {
+        return TRANS_ERROR_PARSE;
+    }
+    if (session->status >= 300 || (docs = yajl_tree_get(node, docs_path, yajl_t_array)) == NULL) {
+        return transport_response_error(session, node);
+    }
+
+    session->mget.num_docs = 0;
+    if ((session->mget.docs = transport_arena_alloc(session, YAJL_GET_ARRAY(docs)->len * sizeof (_get_r) + 1)) == NULL) {
+        return TRANS_ERROR_MEMORY;
+    }
+    for (size_t i = 0; i < YAJL_GET_ARRAY(docs)->len; i++) {
+        if ((ret = transport_get_doc(session, YAJL_GET_ARRAY(docs)->values[i], &session->mget.docs[i])) != 0) {
+            return ret;
+        }
+        session->mget.num_docs++;
+    }
+    session->type = TRANS_SESSION_TYPE_MGET;
+    return 0;
+}
+
+/**
+ * @brief Checks whether a document exists with a HEAD request, no body is
+ * transferred. The request is never hedged, it is too cheap to gain from it.
+ *
+ * @param session transport session struct.
+ * @param index elastic index
+ * @param type elastic type, NULL for _doc
+ * @param id document id
+ *
+ * @return 0 on success or transport error code, session->get.found is 1 if
+ * the document exists and 0 if not.
+ */
+static int
+transport_exists(transport_session_t * session, const char * index, const char * type, const char * id) {
+    char path[TRANSPORT_CALL_URL_LEN];
+    int ret = 0;
+
+    if (session == NULL || id == NULL || id[0] == '\0') {
+        return TRANS_ERROR_INPUT;
+    }
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, type != NULL && type[0] != '\0' ? type : "_doc", id, path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    if ((ret = transport_call(session, path, TRANS_METHOD_HEAD, NULL, NULL)) != 0) {
+        return ret;
+    }
+    if (session->status != 200 && session->status != 404) {
+        return transport_response_error(session, NULL);
+    }
+    memset(&session->get, 0, sizeof (_get_r));
+    session->get.found = session->status == 200;
+    session->type = TRANS_SESSION_TYPE_GET;
+    return 0;
+}
+
+/**
+ * @brief Explicitly refreshes an elastic index.
+ *
+ * @param session transport session struct.
+ * @param index elastic index
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_refresh(transport_session_t * session, const char * index) {
+    char path[TRANSPORT_CALL_URL_LEN];
+    int ret = 0;
+
+    session->type = TRANS_SESSION_TYPE_NONE;
+
+    if (!transport_build_url(index, NULL, "_refresh", path, TRANSPORT_CALL_URL_LEN)) {
+        return TRANS_ERROR_URL;
+    }
+    ret = transport_http_post(session, path, NULL);
+    if (ret != 0) {
+        return ret;
+    }
+    return transport_refresh_response(session);
+}
+
+/**
+ * @brief Parses the response of a refresh request.
+ *
+ * @param session transport session struct.
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_refresh_response(transport_session_t * session) {
+    const char * total_path[] = {"_shards", "total", NULL},
+               * successful_path[] = {"_shards", "successful", NULL},
+               * failed_path[] = {"_shards", "failed", NULL},
+               * status_path[] = {"status", NULL},
+               * error_path[] = {"error", NULL};
+    yajl_val node, v;
+    int ret = 0;
+
+    /* the HTTP status is enough */
+    if (session->options & TRANS_OPTION_STATUS_ONLY) {
+        return transport_status_only(session);
+    }
+
+    /* parse response */
+    node = transport_tree_parse(session);
+    if (node == NULL) {
+        return TRANS_ERROR_PARSE;
+    }
+
+    /* store error and status, if any, in document response */
+    if ((v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
+        ret = TRANS_ERROR_ELASTIC;
         strncpy(session->error.error, YAJL_GET_STRING(v), TRANSPORT_ERROR_LEN);
         if ((v = yajl_tree_get(node, status_path, yajl_t_number)) != NULL) {
             session->error.status = atoi(YAJL_GET_NUMBER(v));
         }
         session->type = TRANS_SESSION_TYPE_ERROR;
-    } else {
-        if ((v = yajl_tree_get(node, acknowledged_path, yajl_t_true)) != NULL) {
-            session->create_index.acknowledged = YAJL_IS_TRUE(v) ? 1 : 0;
+    } else {
+        if ((v = yajl_tree_get(node, total_path, yajl_t_number)) != NULL) {
+            session->refresh._shards.total = atoi(YAJL_GET_NUMBER(v));
+        }
+        if ((v = yajl_tree_get(node, successful_path, yajl_t_number)) != NULL) {
+            session->refresh._shards.successful = atoi(YAJL_GET_NUMBER(v));
+        }
+        if ((v = yajl_tree_get(node, failed_path, yajl_t_number)) != NULL) {
+            session->refresh._shards.failed = atoi(YAJL_GET_NUMBER(v));
+        }
+        session->type = TRANS_SESSION_TYPE_REFRESH;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Creates a bulk indexing buffer on top of a transport session.
+ *
+ * Actions are buffered as NDJSON and sent to _bulk as soon as one of the
+ * limits is reached, or when transport.bulk_flush is called.
+ *
+ * @param session transport session struct.
+ * @param max_bytes flush when the buffered body reaches this size, 0 for default
+ * @param max_actions flush when this many actions are buffered, 0 for default
+ * @param max_age flush when the oldest buffered action is this many seconds
+ * old (checked on add), 0 for default, negative to disable
+ *
+ * @return a bulk struct or NULL on failure.
+ */
+static transport_bulk_t *
+transport_bulk_create(transport_session_t * session, size_t max_bytes, size_t max_actions, int max_age) {
+    transport_bulk_t * bulk = NULL;
+
+    if (session == NULL) {
+        return NULL;
+    }
+    if ((bulk = calloc(1, sizeof (transport_bulk_t))) == NULL) {
+        fprintf(stderr, "transport.bulk_create() failed: could not initialize bulk buffer.\n");
+        return NULL;
+    }
+    bulk->session = session;
+    bulk->max_bytes = max_bytes ? max_bytes : TRANSPORT_BULK_MAX_BYTES;
+    bulk->max_actions = max_actions ? max_actions : TRANSPORT_BULK_MAX_ACTIONS;
+    bulk->max_age = max_age ? max_age : TRANSPORT_BULK_MAX_AGE;
+
+    if (transport_buf_reserve(&bulk->body, TRANSPORT_BUFFER_LEN) != 0) {
+        fprintf(stderr, "transport.bulk_create() failed: could not initialize bulk buffer.\n");
+        transport_bulk_destroy(bulk);
+        return NULL;
+    }
+    return bulk;
+}
+
+/**
+ * @brief Registers the bytes appended to the body from start as a new
+ * action and flushes the buffer if any of its limits has been reached.
+ *
+ * @param bulk bulk struct
+ * @param start offset of the action in the body
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_bulk_commit(transport_bulk_t * bulk, size_t start) {
+    if (bulk->num_actions == bulk->offsets_size) {
+        size_t size = bulk->offsets_size ? bulk->offsets_size * 2 : 64;
+        size_t * offsets = realloc(bulk->offsets, size * sizeof (size_t));
+        if (offsets == NULL) {
+            bulk->body.pos = start;
+            bulk->body.buffer[start] = '\0';
+            return TRANS_ERROR_MEMORY;
+        }
+        bulk->offsets = offsets;
+        bulk->offsets_size = size;
+    }
+    if (bulk->num_actions == 0) {
+        bulk->started = time(NULL);
+    }
+    bulk->offsets[bulk->num_actions++] = start;
+
+    /* actions added from a failure callback wait for the next flush */
+    if (bulk->flushing) {
+        return 0;
+    }
+    if (bulk->num_actions >= bulk->max_actions || bulk->body.pos >= bulk->max_bytes ||
+            (bulk->max_age > 0 && time(NULL) - bulk->started >= bulk->max_age)) {
+        return transport_bulk_flush(bulk);
+    }
+    return 0;
+}
+
+/**
+ * @brief Buffers one bulk action.
+ *
+ * @param bulk bulk struct
+ * @param op TRANS_BULK_INDEX, TRANS_BULK_CREATE, TRANS_BULK_UPDATE or TRANS_BULK_DELETE
+ * @param index elastic index
+ * @param type elastic type, may be NULL
+ * @param id document id, may be NULL for index and create
+ * @param payload document (or update body), ignored for delete
+ *
+ * @return 0 on success or transport error code. The error code of an
+ * automatic flush is returned as well.
+ */
+static int
+transport_bulk_add(transport_bulk_t * bulk, int op, const char * index, const char * type, const char * id, const char * payload) {
+    const char * ops[TRANS_BULK_MAX] = {"{\"index\":{", "{\"create\":{", "{\"update\":{", "{\"delete\":{"};
+    size_t start, source;
+    int ret = 0;
+
+    if (bulk == NULL || op < 0 || op >= TRANS_BULK_MAX || index == NULL || strlen(index) == 0) {
+        return TRANS_ERROR_INPUT;
+    }
+    if ((op == TRANS_BULK_UPDATE || op == TRANS_BULK_DELETE) && (id == NULL || strlen(id) == 0)) {
+        return TRANS_ERROR_INPUT;
+    }
+    if (op != TRANS_BULK_DELETE && payload == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+
+    start = bulk->body.pos;
+
+    /* action and meta data line */
+    ret |= transport_buf_append(&bulk->body, ops[op], strlen(ops[op]));
+    ret |= transport_buf_append(&bulk->body, "\"_index\":", 9);
+    ret |= transport_buf_append_json_string(&bulk->body, index);
+    if (type != NULL && strlen(type) > 0) {
+        ret |= transport_buf_append(&bulk->body, ",\"_type\":", 9);
+        ret |= transport_buf_append_json_string(&bulk->body, type);
+    }
+    if (id != NULL && strlen(id) > 0) {
+        ret |= transport_buf_append(&bulk->body, ",\"_id\":", 7);
+        ret |= transport_buf_append_json_string(&bulk->body, id);
+    }
+    ret |= transport_buf_append(&bulk->body, "}}\n", 3);
+
+    /* source line, newlines can only be whitespace in valid JSON so they
+     * are blanked to keep the document on one line */
+    if (op != TRANS_BULK_DELETE) {
+        source = bulk->body.pos;
+        ret |= transport_buf_append(&bulk->body, payload, strlen(payload));
+        for (size_t i = source; i < bulk->body.pos; i++) {
+            if (bulk->body.buffer[i] == '\n' || bulk->body.buffer[i] == '\r') {
+                bulk->body.buffer[i] = ' ';
+            }
+        }
+        ret |= transport_buf_append(&bulk->body, "\n", 1);
+    }
+
+    if (ret != 0) {
+        /* drop the partial action */
+        bulk->body.pos = start;
+        if (bulk->body.buffer != NULL) {
+            bulk->body.buffer[start] = '\0';
+        }
+        return TRANS_ERROR_MEMORY;
+    }
+    return transport_bulk_commit(bulk, start);
+}
+
+/**
+ * @brief Buffers one already encoded bulk action, typically the NDJSON
+ * handed to a failure callback in order to retry it.
+ *
+ * @param bulk bulk struct
+ * @param data NDJSON action (and source) lines, terminated by a newline
+ * @param len size of data
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_bulk_raw(transport_bulk_t * bulk, const char * data, size_t len) {
+    size_t start;
+
+    if (bulk == NULL || data == NULL || len == 0 || data[len - 1] != '\n') {
+        return TRANS_ERROR_INPUT;
+    }
+    start = bulk->body.pos;
+    if (transport_buf_append(&bulk->body, data, len) != 0) {
+        return TRANS_ERROR_MEMORY;
+    }
+    return transport_bulk_commit(bulk, start);
+}
+
+/**
+ * @brief Copies the error of a bulk item. Newer elastic versions report
+ * errors as an object, older ones as a string.
+ *
+ * @param v error value
+ * @param error destination buffer, TRANSPORT_ERROR_LEN + 1 bytes
+ */
+static void
+transport_bulk_item_error(yajl_val v, char * error) {
+    const char * reason_path[] = {"reason", NULL};
+    yajl_val r;
+
+    if (YAJL_IS_STRING(v)) {
+        strncpy(error, YAJL_GET_STRING(v), TRANSPORT_ERROR_LEN);
+    } else if ((r = yajl_tree_get(v, reason_path, yajl_t_string)) != NULL) {
+        strncpy(error, YAJL_GET_STRING(r), TRANSPORT_ERROR_LEN);
+    } else {
+        strncpy(error, "unknown error", TRANSPORT_ERROR_LEN);
+    }
+    error[TRANSPORT_ERROR_LEN] = '\0';
+}
+
+/**
+ * @brief Moves the buffered actions aside as the sent batch, so the failure
+ * callback may add new actions while the batch's results are handled.
+ *
+ * @param bulk bulk struct
+ *
+ * @return 0 on success or TRANS_ERROR_MEMORY, the actions stay buffered
+ * then.
+ */
+static int
+transport_bulk_take(transport_bulk_t * bulk) {
+    size_t * offsets, size;
+    buf_t body;
+
+    if (bulk->items_size < bulk->num_actions) {
+        _bulk_item_r * items = realloc(bulk->items, bulk->num_actions * sizeof (_bulk_item_r));
+        if (items == NULL) {
+            return TRANS_ERROR_MEMORY;
+        }
+        bulk->items = items;
+        bulk->items_size = bulk->num_actions;
+    }
+
+    body = bulk->sent;
+    bulk->sent = bulk->body;
+    bulk->body = body;
+    bulk->body.pos = 0;
+    if (bulk->body.buffer != NULL) {
+        bulk->body.buffer[0] = '\0';
+    }
+    offsets = bulk->sent_offsets;
+    bulk->sent_offsets = bulk->offsets;
+    bulk->offsets = offsets;
+    bulk->num_items = bulk->num_actions;
+    bulk->num_actions = 0;
+    bulk->started = 0;
+    size = bulk->sent_offsets_size;
+    bulk->sent_offsets_size = bulk->offsets_size;
+    bulk->offsets_size = size;
+    memset(bulk->items, 0, bulk->num_items * sizeof (_bulk_item_r));
+    return 0;
+}
+
+/**
+ * @brief Passes a failed item of the sent batch to bulk->on_failure together
+ * with its NDJSON.
+ *
+ * @param bulk bulk struct
+ * @param i index of the item
+ */
+static void
+transport_bulk_failed(transport_bulk_t * bulk, size_t i) {
+    if (bulk->on_failure != NULL) {
+        size_t start = bulk->sent_offsets[i],
+               end = i + 1 < bulk->num_items ? bulk->sent_offsets[i + 1] : bulk->sent.pos;
+        bulk->on_failure(bulk, &bulk->items[i], &bulk->sent.buffer[start], end - start, bulk->userdata);
+    }
+}
+
+/**
+ * @brief Handles the response of a bulk request for the buffered actions.
+ *
+ * The per item results are stored in bulk->items, in the order the actions
+ * were added, and every failed item is passed to bulk->on_failure together
+ * with its NDJSON so it can be retried with transport.bulk_raw. If the
+ * request fails in a way that is worth retrying, a curl error, 429 or 5xx,
+ * the actions stay buffered. Any other failure, e.g. a 400 for a malformed
+ * action, a 413 for a too large batch or an unparsable response, fails
+ * every action of the batch with the request's status and reason.
+ *
+ * @param bulk bulk struct
+ *
+ * @return 0 on success, TRANS_ERROR_BULK if any item failed or another
+ * transport error code.
+ */
+static int
+transport_bulk_response(transport_bulk_t * bulk) {
+    const char * took_path[] = {"took", NULL},
+               * items_path[] = {"items", NULL},
+               * status_path[] = {"status", NULL},
+               * error_path[] = {"error", NULL},
+               * index_path[] = {"_index", NULL},
+               * type_path[] = {"_type", NULL},
+               * id_path[] = {"_id", NULL};
+    yajl_val node, results = NULL, v, h;
+    transport_session_t * session = bulk->session;
+    int ret = 0;
+
+    /* store error and status, if any, in session */
+    node = transport_tree_parse(session);
+    if (node != NULL && (v = yajl_tree_get(node, error_path, yajl_t_any)) != NULL) {
+        ret = transport_response_error(session, node);
+        if ((v = yajl_tree_get(node, status_path, yajl_t_number)) != NULL) {
+            session->error.status = atoi(YAJL_GET_NUMBER(v));
+        }
+    } else if (session->status >= 300) {
+        ret = transport_response_error(session, node);
+    } else if (node == NULL || (results = yajl_tree_get(node, items_path, yajl_t_array)) == NULL) {
+        ret = TRANS_ERROR_PARSE;
+        session->error.status = session->status;
+        strcpy(session->error.error, "response without bulk items");
+        session->type = TRANS_SESSION_TYPE_ERROR;
+    }
+
+    /* a throttled or unavailable cluster may take the same batch later */
+    if (ret != 0 && (session->error.status == 429 || session->error.status >= 500)) {
+        return ret;
+    }
+    if (transport_bulk_take(bulk) != 0) {
+        return TRANS_ERROR_MEMORY;
+    }
+
+    /* the batch was rejected as a whole, every action failed */
+    if (ret != 0) {
+        bulk->flushing = 1;
+        for (size_t i = 0; i < bulk->num_items; i++) {
+            bulk->items[i].status = session->error.status;
+            snprintf(bulk->items[i].error, sizeof (bulk->items[i].error), "%.*s",
+                    (int) sizeof (session->error.error), session->error.error);
+            transport_bulk_failed(bulk, i);
+        }
+        bulk->flushing = 0;
+        return ret;
+    }
+
+    session->bulk.took = 0;
+    session->bulk.num_items = bulk->num_items;
+    session->bulk.errors = 0;
+    if ((v = yajl_tree_get(node, took_path, yajl_t_number)) != NULL) {
+        session->bulk.took = YAJL_GET_INTEGER(v);
+    }
+    bulk->flushing = 1;
+    for (size_t i = 0; i < results->u.array.len && i < bulk->num_items; ++i) {
+        _bulk_item_r * item = &bulk->items[i];
+        yajl_val obj = results->u.array.values[i];
+
+        /* each item is wrapped in an object keyed by its action */
+        if (!YAJL_IS_OBJECT(obj) || obj->u.object.len != 1) {
+            continue;
+        }
+        obj = obj->u.object.values[0];
+        if ((h = yajl_tree_get(obj, index_path, yajl_t_string)) != NULL) {
+            strncpy(item->_index, YAJL_GET_STRING(h), TRANSPORT_INDEX_LEN);
+        }
+        if ((h = yajl_tree_get(obj, type_path, yajl_t_string)) != NULL) {
+            strncpy(item->_type, YAJL_GET_STRING(h), TRANSPORT_TYPE_LEN);
+        }
+        if ((h = yajl_tree_get(obj, id_path, yajl_t_string)) != NULL) {
+            strncpy(item->_id, YAJL_GET_STRING(h), TRANSPORT_ID_LEN);
+        }
+        if ((h = yajl_tree_get(obj, status_path, yajl_t_number)) != NULL) {
+            item->status = YAJL_GET_INTEGER(h);
+        }
+        if ((h = yajl_tree_get(obj, error_path, yajl_t_any)) != NULL) {
+            transport_bulk_item_error(h, item->error);
+        } else if (item->status < 300) {
+            continue;
+        }
+        session->bulk.errors++;
+        transport_bulk_failed(bulk, i);
+    }
+    bulk->flushing = 0;
+    session->type = TRANS_SESSION_TYPE_BULK;
+
+    return session->bulk.errors ? TRANS_ERROR_BULK : 0;
+}
+
+/**
+ * @brief Sends all buffered actions to _bulk, see
+ * transport_bulk_response for how the outcome is handled.
+ *
+ * @param bulk bulk struct
+ *
+ * @return 0 on success, TRANS_ERROR_BULK if any item failed or another
+ * transport error code.
+ */
+static int
+transport_bulk_flush(transport_bulk_t * bulk) {
+    int ret = 0;
+
+    if (bulk == NULL || bulk->flushing) {
+        return TRANS_ERROR_INPUT;
+    }
+    if (bulk->num_actions == 0) {
+        return 0;
+    }
+    bulk->session->type = TRANS_SESSION_TYPE_NONE;
+
+    ret = transport_call_write(bulk->session, "_bulk", TRANS_METHOD_POST, bulk->body.buffer);
+    if (ret != 0) {
+        return ret;
+    }
+    return transport_bulk_response(bulk);
+}
+
+/**
+ * @brief Cleanup bulk struct. Buffered actions are discarded, call
+ * transport.bulk_flush first to send them.
+ *
+ * @param bulk bulk struct
+ */
+static void
+transport_bulk_destroy(transport_bulk_t * bulk) {
+    if (bulk == NULL) {
+        return;
+    }
+    transport_buf_free(&bulk->body);
+    transport_buf_free(&bulk->sent);
+    free(bulk->offsets);
+    free(bulk->sent_offsets);
+    free(bulk->items);
+    free(bulk);
+}
+
+/**
+ * @brief One time library initialization, initializes curl before any
+ * thread uses it and seeds the random number generator used for session
+ * ids.
+ */
+static void
+transport_global_init(void) {
+    curl_global_init(CURL_GLOBAL_ALL);
+    srand((unsigned int)time(NULL) * getpid());
+}
+
+/**
+ * @brief Builds the request plan of a session: the header lists and the
+ * curl options that are the same for every request are set once, so that
+ * a request only sets its method, body and URL.
+ *
+ * @param session transport session struct
+ *
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int
+transport_plan(transport_session_t * session) {
+    /* without a Content-Type curl sends form data, which elastic rejects */
+    const char * content_types[] = {"Content-Type: application/json", "Content-Type: application/x-ndjson"};
+    struct curl_slist * headers;
+
+    for (int i = 0; i < TRANSPORT_HEADER_PLANS; i++) {
+        if ((headers = curl_slist_append(NULL, "Accept: application/json")) == NULL ||
+                (headers = curl_slist_append(headers, "charsets: utf-8")) == NULL ||
+                (headers = curl_slist_append(headers, content_types[i / 2])) == NULL ||
+                (i % 2 == 1 && (headers = curl_slist_append(headers, "Content-Encoding: gzip")) == NULL)) {
+            curl_slist_free_all(headers);
+            return -1;
+        }
+        session->headers[i] = headers;
+    }
+    curl_easy_setopt(session->curl, CURLOPT_HTTPHEADER, session->headers[0]);
+    curl_easy_setopt(session->curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+    curl_easy_setopt(session->curl, CURLOPT_FORBID_REUSE, 0L);
+    curl_easy_setopt(session->curl, CURLOPT_WRITEFUNCTION, transport_memorize_response);
+    curl_easy_setopt(session->curl, CURLOPT_WRITEDATA, session);
+    return 0;
+}
+
+/**
+ * @brief Sets the connection options of a host set on a curl handle.
+ *
+ * @param curl curl handle
+ * @param set host set
+ */
+static void
+transport_plan_hosts(CURL * curl, transport_hosts_t * set) {
+    curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, (long) set->tcp_nodelay);
+    if (set->tcp_keepalive > 0) {
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, set->tcp_keepalive);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, set->tcp_keepalive);
+    }
+    if (set->unix_socket != NULL) {
+        curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, set->unix_socket);
+    }
+    if (set->resolve != NULL) {
+        curl_easy_setopt(curl, CURLOPT_RESOLVE, set->resolve);
+    }
+}
+
+/**
+ * @brief Opens a connection to every host with a HEAD request, so that the
+ * first requests do not pay for name resolution and the TCP and TLS
+ * handshakes. Hosts that cannot be reached are marked dead.
+ *
+ * @param session transport session struct
+ */
+static void
+transport_preconnect(transport_session_t * session) {
+    size_t num_hosts;
+    CURLcode res;
+
+    pthread_mutex_lock(&session->hosts->lock);
+    num_hosts = session->hosts->num_hosts;
+    pthread_mutex_unlock(&session->hosts->lock);
+
+    transport_prepare(session, "", TRANS_METHOD_HEAD, NULL, 0, NULL);
+    for (size_t i = 0; i < num_hosts; i++) {
+        if (transport_use_host(session, i, "") != 0) {
+            break;
+        }
+        res = curl_easy_perform(session->curl);
+        transport_host_end(session, res);
+    }
+}
+
+/**
+ * @brief Allocate a session struct and its curl handle.
+ *
+ * @return a transport session struct or NULL on failure.
+ */
+static transport_session_t *
+transport_session_new(void) {
+
+    static pthread_once_t initialized = PTHREAD_ONCE_INIT;
+    transport_session_t * session = NULL;
+
+    pthread_once(&initialized, transport_global_init);
+
+    /* allocate memory for session struct. */
+    if ((session = calloc(1, sizeof (transport_session_t))) == NULL) {
+        return NULL;
+    }
+
+    /* initialize curl. */
+    if ((session->curl = curl_easy_init()) == NULL) {
+        free(session);
+        return NULL;
+    }
+    curl_easy_setopt(session->curl, CURLOPT_PRIVATE, session);
+    if (transport_plan(session) != 0) {
+        for (int i = 0; i < TRANSPORT_HEADER_PLANS; i++) {
+            curl_slist_free_all(session->headers[i]);
+        }
+        curl_easy_cleanup(session->curl);
+        free(session);
+        return NULL;
+    }
+
+    /* generate a kind of unique session id */
+    transport_session_id((char *)&session->id, TRANSPORT_SESSION_ID_LEN); 
+    session->seed = (unsigned int) rand();
+
+    return session;
+}
+
+/**
+ * @brief Reads a list of ints from the configuration.
+ *
+ * @param cfg parsed configuration
+ * @param name setting, an array or list of ints
+ * @param values destination
+ * @param max capacity of values
+ *
+ * @return number of values read, or -1 if the setting is missing.
+ */
+static int
+transport_config_ints(const config_t * cfg, const char * name, int * values, size_t max) {
+    config_setting_t * setting;
+    size_t count = 0;
+
+    if ((setting = config_lookup(cfg, name)) == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < config_setting_length(setting) && count < max; i++) {
+        values[count++] = config_setting_get_int_elem(setting, i);
+    }
+    return (int) count;
+}
+
+/**
+ * @brief Reads the retry policy from the configuration.
+ *
+ * @param retry retry policy
+ * @param cfg parsed configuration
+ */
+static void
+transport_retry_configure(transport_retry_t * retry, const config_t * cfg) {
+    static const int statuses[] = {429, 502, 503, 504};
+    static const int curl_codes[] = {CURLE_COULDNT_CONNECT, CURLE_OPERATION_TIMEDOUT, CURLE_GOT_NOTHING,
+        CURLE_SEND_ERROR, CURLE_RECV_ERROR};
+    int count;
+
+    if (!config_lookup_int(cfg, "retries", &retry->max_retries) || retry->max_retries < 0) {
+        retry->max_retries = 0;
+    }
+    retry->backoff_ms = transport_config_ms(cfg, "retry_backoff_ms", NULL, TRANSPORT_RETRY_BACKOFF);
+    retry->backoff_max_ms = transport_config_ms(cfg, "retry_backoff_max_ms", NULL, TRANSPORT_RETRY_BACKOFF_MAX);
+
+    if ((count = transport_config_ints(cfg, "retry_statuses", retry->statuses, TRANSPORT_RETRY_CODES)) < 0) {
+        memcpy(retry->statuses, statuses, sizeof (statuses));
+        count = sizeof (statuses) / sizeof (statuses[0]);
+    }
+    retry->num_statuses = count;
+    if ((count = transport_config_ints(cfg, "retry_curl_codes", retry->curl_codes, TRANSPORT_RETRY_CODES)) < 0) {
+        memcpy(retry->curl_codes, curl_codes, sizeof (curl_codes));
+        count = sizeof (curl_codes) / sizeof (curl_codes[0]);
+    }
+    retry->num_curl_codes = count;
+}
+
+/**
+ * @brief Reads the settings of a parsed configuration and creates its
+ * host set.
+ *
+ * @param config destination
+ * @param cfg parsed configuration.
+ *
+ * @return 0 on success or TRANS_ERROR_INPUT if no hosts are configured.
+ */
+static int
+transport_config_read(transport_config_t * config, const config_t * cfg) {
+
+    int value;
+
+    /* lookup timeouts from config, a timeout in seconds is still accepted.  */
+    config->timeout_ms = transport_config_ms(cfg, "timeout_ms", "timeout", TRANSPORT_DEFAULT_TIMEOUT * 1000L);
+    config->connect_timeout_ms = transport_config_ms(cfg, "connect_timeout_ms", NULL, config->timeout_ms);
+
+    transport_retry_configure(&config->retry, cfg);
+
+    /* lookup buffer sizes from config, buffers are allocated on first use
+     * and grow as needed. */
+    if (!config_lookup_int(cfg, "response_size", &value) || value <= 0) {
+        value = TRANSPORT_RESPONSE_LEN;
+    }
+    config->response_size = value;
+    if (!config_lookup_int(cfg, "arena_size", &value) || value <= 0) {
+        value = TRANSPORT_ARENA_LEN;
+    }
+    config->arena_size = value;
+    if (!config_lookup_int(cfg, "max_hits", &value) || value < 0) {
+        value = TRANSPORT_DEFAULT_MAX_HITS;
+    }
+    config->max_hits = value;
+
+    /* compression is off unless configured */
+    if (!config_lookup_bool(cfg, "accept_encoding", &config->accept_encoding)) {
+        config->accept_encoding = 0;
+    }
+    if (!config_lookup_int(cfg, "compress_threshold", &value) || value < 0) {
+        value = 0;
+    }
+    config->compress_threshold = value;
+    if (!config_lookup_int(cfg, "compress_level", &config->compress_level) ||
+            config->compress_level < 1 || config->compress_level > 9) {
+        config->compress_level = TRANSPORT_COMPRESS_LEVEL;
+    }
+
+    if ((config->hosts = transport_hosts_create(cfg)) == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies the settings of a configuration to a session, which shares
+ * its host set.
+ *
+ * @param session transport session struct.
+ * @param config configuration.
+ */
+static void
+transport_config_apply(transport_session_t * session, const transport_config_t * config) {
+    session->timeout_ms = config->timeout_ms;
+    session->connect_timeout_ms = config->connect_timeout_ms;
+    session->retry = config->retry;
+    session->response_size = config->response_size;
+    session->arena_size = config->arena_size;
+    session->max_hits = config->max_hits;
+    session->accept_encoding = config->accept_encoding;
+    session->compress_threshold = config->compress_threshold;
+    session->compress_level = config->compress_level;
+    /* curl decodes the responses */
+    if (session->accept_encoding) {
+        curl_easy_setopt(session->curl, CURLOPT_ACCEPT_ENCODING, "gzip, deflate");
+    }
+    session->hosts = transport_hosts_retain(config->hosts);
+    transport_plan_hosts(session->curl, session->hosts);
+}
+
+/**
+ * @brief Parse a configuration file once for any number of sessions. The
+ * cluster nodes are discovered here if sniffing is enabled.
+ *
+ * @param path Path to configuration file.
+ *
+ * @return a configuration or NULL on failure.
+ */
+static transport_config_t *
+transport_config_load(const char * path) {
+
+    transport_config_t * config = NULL;
+    transport_session_t * session;
+    config_t cfg;
+
+    config_init(&cfg);
+
+    if ((config = calloc(1, sizeof (transport_config_t))) == NULL) {
+        fprintf(stderr, "transport.config_load() failed: could not allocate configuration.\n");
+        goto transport_config_load_error;
+    }
+
+    /* load config. */
+    if (path == NULL || !config_read_file(&cfg, path)) {
+        fprintf(stderr, "transport.config_load() failed: could not parse config file.\n");
+        goto transport_config_load_error;
+    }
+
+    if (transport_config_read(config, &cfg) != 0) {
+        fprintf(stderr, "transport.config_load() failed: missing 'hosts' in configuration file.\n");
+        goto transport_config_load_error;
+    }
+
+    /* discover the cluster nodes, the configured hosts stay on failure */
+    if (config->hosts->sniff_interval > 0 && (session = transport_create_from(config)) != NULL) {
+        transport_sniff(session);
+        config->hosts->sniff_next = transport_now_ms() + config->hosts->sniff_interval * 1000LL;
+        transport_destroy(session);
+    }
+
+    config_destroy(&cfg);
+    return config;
+
+transport_config_load_error:
+    /* cleanup */
+    transport_config_destroy(config);
+    config_destroy(&cfg);
+    return NULL;
+}
+
+/**
+ * @brief Free a configuration. Sessions created from it stay valid.
+ *
+ * @param config configuration or NULL.
+ */
+static void
+transport_config_destroy(transport_config_t * config) {
+    if (config == NULL) {
+        return;
+    }
+    transport_hosts_release(config->hosts);
+    free(config);
+}
+
+/**
+ * @brief Create a transport session from a parsed configuration. Only the
+ * session itself and its curl handle are allocated, so sessions can be
+ * created per request or per task. Safe to call from several threads with
+ * the same configuration.
+ *
+ * @param config configuration from transport.config_load.
+ *
+ * @return a transport session struct or NULL on failure.
+ */
+static transport_session_t *
+transport_create_from(const transport_config_t * config) {
+    transport_session_t * session;
+
+    if (config == NULL || (session = transport_session_new()) == NULL) {
+        return NULL;
+    }
+    transport_config_apply(session, config);
+    return session;
+}
+
+/**
+ * @brief Create and initialize a transport session struct.
+ *
+ * @param config Path to configuration file.
+ *
+ * @return a transport session struct.
+ */
+static transport_session_t *
+transport_create(const char * config) {
+
+    transport_session_t * session = NULL;
+    transport_config_t * parsed;
+
+    if ((parsed = transport_config_load(config)) == NULL) {
+        return NULL;
+    }
+    if ((session = transport_create_from(parsed)) == NULL) {
+        fprintf(stderr, "transport.create() failed: could not initialize transport session.\n");
+    } else if (session->hosts->preconnect) {
+        transport_preconnect(session);
+    }
+    transport_config_destroy(parsed);
+    return session;
+}
+
+/**
+ * @brief Lock callback for the shared curl handle.
+ */
+static void
+transport_share_lock(CURL * handle, curl_lock_data data, curl_lock_access access, void * userp) {
+    transport_pool_t * pool = userp;
+    pthread_mutex_lock(&pool->share_locks[data]);
+}
+
+/**
+ * @brief Unlock callback for the shared curl handle.
+ */
+static void
+transport_share_unlock(CURL * handle, curl_lock_data data, void * userp) {
+    transport_pool_t * pool = userp;
+    pthread_mutex_unlock(&pool->share_locks[data]);
+}
+
+/**
+ * @brief Create a pool of sessions sharing DNS cache, connections and TLS
+ * sessions. The configuration file is parsed once for all sessions.
+ *
+ * @param config Path to configuration file.
+ * @param size Number of sessions in the pool.
+ *
+ * @return a transport pool struct or NULL on failure.
+ */
+static transport_pool_t *
+transport_pool_create(const char * config, size_t size) {
+
+    transport_pool_t * pool = NULL;
+    transport_config_t * parsed = NULL;
+
+    if (config == NULL || size == 0) {
+        return NULL;
+    }
+
+    /* all sessions share one host set and its statistics */
+    if ((parsed = transport_config_load(config)) == NULL) {
+        return NULL;
+    }
+
+    if ((pool = calloc(1, sizeof (transport_pool_t))) == NULL ||
+        (pool->sessions = calloc(size, sizeof (transport_session_t *))) == NULL ||
+        (pool->idle = calloc(size, sizeof (transport_session_t *))) == NULL) {
+        fprintf(stderr, "transport.pool_create() failed: could not allocate pool.\n");
+        goto transport_pool_create_error;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&pool->share_locks[i], NULL);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->available, NULL);
+
+    /* share DNS cache, connection cache and TLS sessions between handles */
+    if ((pool->share = curl_share_init()) == NULL) {
+        fprintf(stderr, "transport.pool_create() failed: could not initialize curl share.\n");
+        goto transport_pool_create_error;
+    }
+    curl_share_setopt(pool->share, CURLSHOPT_LOCKFUNC, transport_share_lock);
+    curl_share_setopt(pool->share, CURLSHOPT_UNLOCKFUNC, transport_share_unlock);
+    curl_share_setopt(pool->share, CURLSHOPT_USERDATA, pool);
+    curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    for (; pool->size < size; pool->size++) {
+        transport_session_t * session = transport_create_from(parsed);
+        if (session == NULL) {
+            fprintf(stderr, "transport.pool_create() failed: could not initialize transport session.\n");
+            goto transport_pool_create_error;
         }
-        session->type = TRANS_SESSION_TYPE_CREATE_INDEX;
+        curl_easy_setopt(session->curl, CURLOPT_SHARE, pool->share);
+        session->pool = pool;
+        pool->sessions[pool->size] = session;
+        pool->idle[pool->num_idle++] = session;
     }
 
-    return ret;
+    /* the connections go to the shared connection cache */
+    if (parsed->hosts->preconnect) {
+        transport_preconnect(pool->sessions[0]);
+    }
+
+    transport_config_destroy(parsed);
+    return pool;
+
+transport_pool_create_error:
+    transport_config_destroy(parsed);
+    transport_pool_destroy(pool);
+    return NULL;
 }
 
 /**
- * @brief Deletes an elastic index.
+ * @brief Take an idle session from the pool, waiting for one to be checked
+ * in if all are in use.
+ *
+ * @param pool transport pool struct.
+ *
+ * @return a transport session struct or NULL if pool is NULL.
+ */
+static transport_session_t *
+transport_pool_checkout(transport_pool_t * pool) {
+    transport_session_t * session;
+    if (pool == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (pool->num_idle == 0) {
+        pthread_cond_wait(&pool->available, &pool->lock);
+    }
+    session = pool->idle[--pool->num_idle];
+    pthread_mutex_unlock(&pool->lock);
+    return session;
+}
+
+/**
+ * @brief Return a session to its pool. Its deadline and options are cleared
+ * so they do not carry over to the next user.
+ *
+ * @param session transport session struct from transport.pool_checkout.
+ */
+static void
+transport_pool_checkin(transport_session_t * session) {
+    transport_pool_t * pool;
+    if (session == NULL || (pool = session->pool) == NULL) {
+        return;
+    }
+    session->deadline = 0;
+    session->options = 0;
+    pthread_mutex_lock(&pool->lock);
+    pool->idle[pool->num_idle++] = session;
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Destroy a pool and all its sessions, no session may be checked out.
+ *
+ * @param pool transport pool struct.
+ */
+static void
+transport_pool_destroy(transport_pool_t * pool) {
+    if (pool == NULL) {
+        return;
+    }
+    for (size_t i = 0; pool->sessions != NULL && i < pool->size; i++) {
+        pool->sessions[i]->pool = NULL;
+        transport_destroy(pool->sessions[i]);
+    }
+    /* the share can only be released once no handle uses it */
+    if (pool->share != NULL) {
+        curl_share_cleanup(pool->share);
+    }
+    /* locks are initialized once the session arrays are allocated */
+    if (pool->idle != NULL) {
+        for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+            pthread_mutex_destroy(&pool->share_locks[i]);
+        }
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->available);
+    }
+    free(pool->sessions);
+    free(pool->idle);
+    free(pool);
+}
+
+/**
+ * @brief Create a second session with the configuration of session. It
+ * shares the connection cache of session's pool, if any.
  *
  * @param session transport session struct.
+ *
+ * @return a transport session struct or NULL on failure.
+ */
+static transport_session_t *
+transport_session_clone(transport_session_t * session) {
+    transport_session_t * clone;
+
+    if ((clone = transport_session_new()) == NULL) {
+        return NULL;
+    }
+    clone->hosts = transport_hosts_retain(session->hosts);
+    transport_plan_hosts(clone->curl, clone->hosts);
+    clone->timeout_ms = session->timeout_ms;
+    clone->connect_timeout_ms = session->connect_timeout_ms;
+    clone->retry = session->retry;
+    clone->options = session->options;
+    clone->response_size = session->response_size;
+    clone->arena_size = session->arena_size;
+    clone->max_hits = session->max_hits;
+    clone->accept_encoding = session->accept_encoding;
+    clone->compress_threshold = session->compress_threshold;
+    clone->compress_level = session->compress_level;
+    if (clone->accept_encoding) {
+        curl_easy_setopt(clone->curl, CURLOPT_ACCEPT_ENCODING, "gzip, deflate");
+    }
+    if (session->pool != NULL) {
+        curl_easy_setopt(clone->curl, CURLOPT_SHARE, session->pool->share);
+    }
+    return clone;
+}
+
+/**
+ * @brief Create an iterator over all hits of a search, fetched page by
+ * page with the scroll API or with search_after in a point in time. The
+ * next page is fetched in the background while the caller processes the
+ * current one.
+ *
+ * @param session transport session struct, used for every other page.
  * @param index elastic index
+ * @param type elastic type, ignored by TRANS_SCROLL_SEARCH_AFTER
+ * @param payload search body, a JSON object. TRANS_SCROLL_SEARCH_AFTER
+ * needs a sort.
+ * @param keep_alive how long elastic keeps the cursor between pages, NULL
+ * for TRANSPORT_DEFAULT_KEEP_ALIVE
+ * @param mode TRANS_SCROLL_SCROLL_ID or TRANS_SCROLL_SEARCH_AFTER
+ *
+ * @return a scroll struct or NULL on failure.
+ */
+static transport_scroll_t *
+transport_scroll_create(transport_session_t * session, const char * index, const char * type, const char * payload,
+        const char * keep_alive, int mode) {
+    transport_scroll_t * scroll;
+    const char * action = mode == TRANS_SCROLL_SEARCH_AFTER ? "_pit" : "_search";
+    const char * param = mode == TRANS_SCROLL_SEARCH_AFTER ? "keep_alive" : "scroll";
+    int len;
+
+    if (session == NULL || index == NULL || mode < 0 || mode >= TRANS_SCROLL_MAX) {
+        return NULL;
+    }
+    if (keep_alive == NULL) {
+        keep_alive = TRANSPORT_DEFAULT_KEEP_ALIVE;
+    }
+    if (payload == NULL) {
+        payload = "{}";
+    }
+    if (strlen(keep_alive) > TRANSPORT_KEEP_ALIVE_LEN) {
+        return NULL;
+    }
+    if ((scroll = calloc(1, sizeof (transport_scroll_t))) == NULL) {
+        return NULL;
+    }
+    scroll->mode = mode;
+    scroll->current = -1;
+    strcpy(scroll->keep_alive, keep_alive);
+
+    /* the first request opens the cursor, a point in time is not bound to a type */
+    len = transport_build_url(index, mode == TRANS_SCROLL_SEARCH_AFTER ? NULL : type, action, scroll->path, TRANSPORT_CALL_URL_LEN);
+    if (!len || len + strlen(param) + strlen(keep_alive) + 2 >= TRANSPORT_CALL_URL_LEN ||
+            transport_buf_append(&scroll->query, payload, strlen(payload)) != 0 ||
+            (scroll->pages[1] = transport_session_clone(session)) == NULL) {
+        transport_scroll_destroy(scroll);
+        return NULL;
+    }
+    sprintf(scroll->path + len, "?%s=%s", param, keep_alive);
+    scroll->pages[0] = session;
+
+    /* a page cut at max_hits would lose the rest of its hits and, with
+     * search_after, resume from a hit before the end of the page */
+    scroll->max_hits = session->max_hits;
+    session->max_hits = 0;
+    scroll->pages[1]->max_hits = 0;
+    return scroll;
+}
+
+/**
+ * @brief Appends a JSON object made of members followed by the members of
+ * the object query.
+ *
+ * @param buf buffer
+ * @param members JSON object members, without braces
+ * @param len length of members
+ * @param query zero terminated JSON object
  *
  * @return 0 on success or transport error code.
  */
 static int
-transport_delete_index(transport_session_t * session, const char * index) {
-    char path[TRANSPORT_CALL_URL_LEN];
-    const char * acknowledged_path[] = {"acknowledged", NULL},
-           * status_path[] = {"status", NULL},
-           * error_path[] = {"error", NULL};
+transport_buf_append_merged(buf_t * buf, const char * members, size_t len, const char * query) {
+
+    /* skip the opening brace of query */
+    while (*query == ' ' || *query == '\t' || *query == '\r' || *query == '\n') {
+        query++;
+    }
+    if (*query != '{') {
+        return TRANS_ERROR_INPUT;
+    }
+    for (query++; *query == ' ' || *query == '\t' || *query == '\r' || *query == '\n'; query++);
+
+    if (transport_buf_append(buf, "{", 1) != 0 ||
+            transport_buf_append(buf, members, len) != 0 ||
+            (*query != '}' && transport_buf_append(buf, ",", 1) != 0) ||
+            transport_buf_append(buf, query, strlen(query)) != 0) {
+        return TRANS_ERROR_MEMORY;
+    }
+    return 0;
+}
+
+/**
+ * @brief Builds the body of a search_after request, the caller's query
+ * with the point in time and, after the first page, the sort values of
+ * the last hit added.
+ *
+ * @param scroll scroll struct
+ * @param after raw JSON sort values or NULL
+ * @param after_len length of after
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_scroll_search_after(transport_scroll_t * scroll, const char * after, size_t after_len) {
+    buf_t members = {0};
+    int ret = TRANS_ERROR_MEMORY;
+
+    if (transport_buf_append(&members, "\"pit\":{\"id\":", 12) == 0 &&
+            transport_buf_append(&members, scroll->cursor.buffer, scroll->cursor.pos) == 0 &&
+            transport_buf_append(&members, ",\"keep_alive\":", 14) == 0 &&
+            transport_buf_append_json_string(&members, scroll->keep_alive) == 0 &&
+            transport_buf_append(&members, "}", 1) == 0 &&
+            (after == NULL || (transport_buf_append(&members, ",\"search_after\":", 16) == 0 &&
+                    transport_buf_append(&members, after, after_len) == 0))) {
+        scroll->body.pos = 0;
+        ret = transport_buf_append_merged(&scroll->body, members.buffer, members.pos, scroll->query.buffer);
+    }
+    transport_buf_free(&members);
+    return ret;
+}
+
+/**
+ * @brief Stores the cursor of the page in session and builds the request
+ * for the next page.
+ *
+ * @param scroll scroll struct
+ * @param session session holding the page
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_scroll_prepare(transport_scroll_t * scroll, transport_session_t * session) {
+    transport_span_t * cursor = scroll->mode == TRANS_SCROLL_SEARCH_AFTER ? &session->search.pit_id_span : &session->search._scroll_id_span;
+    _hits_r * hits = &session->search.hits;
+
+    /* elastic may hand out a new cursor with every page, keep it quoted */
+    if (cursor->length > 0) {
+        scroll->cursor.pos = 0;
+        if (transport_buf_append(&scroll->cursor, TRANSPORT_SPAN(session, *cursor) - 1, cursor->length + 2) != 0) {
+            return TRANS_ERROR_MEMORY;
+        }
+    }
+    if (scroll->cursor.pos == 0) {
+        return TRANS_ERROR_PARSE;
+    }
+
+    if (scroll->mode == TRANS_SCROLL_SEARCH_AFTER) {
+        _hit_r * last = &hits->hits[hits->num_hits - 1];
+        if (last->sort_span.length == 0) {
+            return TRANS_ERROR_INPUT;
+        }
+        strcpy(scroll->path, "_search");
+        return transport_scroll_search_after(scroll, TRANSPORT_SPAN(session, last->sort_span), last->sort_span.length);
+    }
+
+    strcpy(scroll->path, "_search/scroll");
+    scroll->body.pos = 0;
+    if (transport_buf_append(&scroll->body, "{\"scroll\":", 10) != 0 ||
+            transport_buf_append_json_string(&scroll->body, scroll->keep_alive) != 0 ||
+            transport_buf_append(&scroll->body, ",\"scroll_id\":", 13) != 0 ||
+            transport_buf_append(&scroll->body, scroll->cursor.buffer, scroll->cursor.pos) != 0 ||
+            transport_buf_append(&scroll->body, "}", 1) != 0) {
+        return TRANS_ERROR_MEMORY;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fetches the next page into the session that does not hold the
+ * current page.
+ *
+ * @param scroll scroll struct
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_scroll_fetch(transport_scroll_t * scroll) {
+    transport_session_t * session = scroll->pages[(scroll->current + 1) % 2];
+    int ret;
+
+    session->type = TRANS_SESSION_TYPE_NONE;
+    ret = transport_call(session, scroll->path, TRANS_METHOD_POST, scroll->body.buffer, &transport_search_callbacks);
+    if (ret != 0) {
+        return ret;
+    }
+    return transport_search_response(session);
+}
+
+/**
+ * @brief Prefetch thread.
+ *
+ * @param arg scroll struct
+ *
+ * @return NULL
+ */
+static void *
+transport_scroll_thread(void * arg) {
+    transport_scroll_t * scroll = (transport_scroll_t *) arg;
+    scroll->result = transport_scroll_fetch(scroll);
+    return NULL;
+}
+
+/**
+ * @brief Opens the point in time of a search_after iterator.
+ *
+ * @param scroll scroll struct
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_scroll_open(transport_scroll_t * scroll) {
+    const char * id_path[] = {"id", NULL};
+    transport_session_t * session = scroll->pages[0];
     yajl_val node, v;
-    int ret = 0;
-    char eb[1024];
+    int ret;
 
-    session->type = TRANS_SESSION_TYPE_NONE;
-
-    if (!transport_build_url(index, NULL, NULL, path, TRANSPORT_CALL_URL_LEN)) {
-        return TRANS_ERROR_URL;
-    }
-    ret = transport_http_delete(session, path, NULL);
-    if (ret != 0) {
+    if ((ret = transport_call(session, scroll->path, TRANS_METHOD_POST, NULL, NULL)) != 0) {
         return ret;
     }
-    
-    /* parse response */
-    node = yajl_tree_parse(session->raw.buffer, eb, sizeof(eb));
-    if (node == NULL) {
+    if ((node = transport_tree_parse(session)) == NULL) {
         return TRANS_ERROR_PARSE;
     }
-
-    /* store error and status, if any, in document response */
-    if ((v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
-        ret = TRANS_ERROR_ELASTIC;
-        strncpy(session->error.error, YAJL_GET_STRING(v), TRANSPORT_ERROR_LEN);
-        if ((v = yajl_tree_get(node, status_path, yajl_t_number)) != NULL) {
-            session->error.status = atoi(YAJL_GET_NUMBER(v));
-        }
-        session->type = TRANS_SESSION_TYPE_ERROR;
-    } else {
-        if ((v = yajl_tree_get(node, acknowledged_path, yajl_t_true)) != NULL) {
-            session->delete_index.acknowledged = YAJL_IS_TRUE(v) ? 1 : 0;
-        }
-        session->type = TRANS_SESSION_TYPE_DELETE_INDEX;
+    if ((v = yajl_tree_get(node, id_path, yajl_t_string)) == NULL) {
+        return TRANS_ERROR_ELASTIC;
     }
-
-    return ret;
+    scroll->cursor.pos = 0;
+    if (transport_buf_append_json_string(&scroll->cursor, YAJL_GET_STRING(v)) != 0) {
+        return TRANS_ERROR_MEMORY;
+    }
+    strcpy(scroll->path, "_search");
+    return transport_scroll_search_after(scroll, NULL, 0);
 }
 
 /**
- * @brief Stores a new document in elastic.
+ * @brief Returns the next page of hits. The page stays valid until the
+ * next call, meanwhile the following page is fetched.
  *
- * @param session transport session struct.
- * @param index elastic index
- * @param type elastic type
- * @param id document id
- * @param payload HTTP PUT body
+ * @param scroll scroll struct
+ * @param page set to the session holding the page in page->search, or
+ * NULL once all hits have been returned
  *
  * @return 0 on success or transport error code.
  */
 static int
-transport_index_document(transport_session_t * session, const char * index, const char * type, const char * id, const char * payload) {
-    char path[TRANSPORT_CALL_URL_LEN];
-    const char * index_path[] = {"_index", NULL},
-               * type_path[] = {"_type", NULL},
-               * id_path[] = {"_id", NULL},
-               * version_path[] = {"_version", NULL},
-               * created_path[] = {"created", NULL},
-               * status_path[] = {"status", NULL},
-               * error_path[] = {"error", NULL};
-    yajl_val node, v;
-    int ret = 0;
-    char eb[1024];
+transport_scroll_next(transport_scroll_t * scroll, transport_session_t ** page) {
+    transport_session_t * session;
+    int ret;
 
-    session->type = TRANS_SESSION_TYPE_NONE;
+    if (scroll == NULL || page == NULL) {
+        return TRANS_ERROR_INPUT;
+    }
+    *page = NULL;
+    if (scroll->done) {
+        return 0;
+    }
 
-    if (!transport_build_url(index, type, id, path, TRANSPORT_CALL_URL_LEN)) {
-        return TRANS_ERROR_URL;
+    if (scroll->current < 0) {
+        /* first page */
+        if (scroll->mode == TRANS_SCROLL_SEARCH_AFTER) {
+            if ((ret = transport_scroll_open(scroll)) != 0) {
+                return ret;
+            }
+        } else {
+            scroll->body.pos = 0;
+            if (transport_buf_append(&scroll->body, scroll->query.buffer, scroll->query.pos) != 0) {
+                return TRANS_ERROR_MEMORY;
+            }
+        }
+        ret = transport_scroll_fetch(scroll);
+    } else if (scroll->prefetching) {
+        pthread_join(scroll->thread, NULL);
+        scroll->prefetching = 0;
+        ret = scroll->result;
+    } else {
+        ret = transport_scroll_fetch(scroll);
     }
-    ret = transport_http_put(session, path, payload);
     if (ret != 0) {
         return ret;
     }
+    scroll->current = (scroll->current + 1) % 2;
+    session = scroll->pages[scroll->current];
 
-    /* parse response */
-    node = yajl_tree_parse(session->raw.buffer, eb, sizeof(eb));
-    if (node == NULL) {
-        return TRANS_ERROR_PARSE;
+    if (session->search.hits.num_hits == 0) {
+        scroll->done = 1;
+        return 0;
     }
 
-    /* store error and status, if any, in document response */
-    if ((v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
-        ret = TRANS_ERROR_ELASTIC;
-        strncpy(session->error.error, YAJL_GET_STRING(v), TRANSPORT_ERROR_LEN);
-        if ((v = yajl_tree_get(node, status_path, yajl_t_number)) != NULL) {
-            session->error.status = atoi(YAJL_GET_NUMBER(v));
-        }
-        session->type = TRANS_SESSION_TYPE_ERROR;
-    } else {
-        /* store index in document response */
-        if ((v = yajl_tree_get(node, index_path, yajl_t_string)) != NULL) {
-            strncpy(session->index_document._index, YAJL_GET_STRING(v), TRANSPORT_INDEX_LEN);
-        }
-        /* store type in document response */
-        if ((v = yajl_tree_get(node, type_path, yajl_t_string)) != NULL) {
-            strncpy(session->index_document._type, YAJL_GET_STRING(v), TRANSPORT_TYPE_LEN);
-        }
-        /* store id in document response */
-        if ((v = yajl_tree_get(node, id_path, yajl_t_string)) != NULL) {
-            strncpy(session->index_document._id, YAJL_GET_STRING(v), TRANSPORT_ID_LEN);
-        }
-        /* store version in document response */
-        if ((v = yajl_tree_get(node, version_path, yajl_t_number)) != NULL) {
-            session->index_document._version = atoi(YAJL_GET_NUMBER(v));
-        }
-        /* store created in document response */
-        if ((v = yajl_tree_get(node, created_path, yajl_t_true)) != NULL) {
-            session->index_document.created = YAJL_IS_TRUE(v) ? 1 : 0;
-        }
-        session->type = TRANS_SESSION_TYPE_INDEX_DOCUMENT;
+    /* start fetching the following page */
+    if ((ret = transport_scroll_prepare(scroll, session)) != 0) {
+        return ret;
     }
+    if (pthread_create(&scroll->thread, NULL, transport_scroll_thread, scroll) == 0) {
+        scroll->prefetching = 1;
+    }
+    *page = session;
+    return 0;
+}
 
-    return ret;
+/**
+ * @brief Cleanup scroll struct and release the cursor in elastic. The
+ * session passed to transport.scroll_create is not destroyed.
+ *
+ * @param scroll scroll struct
+ */
+static void
+transport_scroll_destroy(transport_scroll_t * scroll) {
+    transport_session_t * session;
+
+    if (scroll == NULL) {
+        return;
+    }
+    if (scroll->prefetching) {
+        pthread_join(scroll->thread, NULL);
+    }
+    /* release the cursor, using the session the caller does not own */
+    if ((session = scroll->pages[1]) != NULL && scroll->cursor.pos > 0) {
+        const char * key = scroll->mode == TRANS_SCROLL_SEARCH_AFTER ? "{\"id\":" : "{\"scroll_id\":";
+        scroll->body.pos = 0;
+        if (transport_buf_append(&scroll->body, key, strlen(key)) == 0 &&
+                transport_buf_append(&scroll->body, scroll->cursor.buffer, scroll->cursor.pos) == 0 &&
+                transport_buf_append(&scroll->body, "}", 1) == 0) {
+            transport_call(session, scroll->mode == TRANS_SCROLL_SEARCH_AFTER ? "_pit" : "_search/scroll",
+                    TRANS_METHOD_DELETE, scroll->body.buffer, NULL);
+        }
+    }
+    transport_destroy(scroll->pages[1]);
+    if (scroll->pages[0] != NULL) {
+        scroll->pages[0]->max_hits = scroll->max_hits;
+    }
+    transport_buf_free(&scroll->query);
+    transport_buf_free(&scroll->cursor);
+    transport_buf_free(&scroll->body);
+    free(scroll);
 }
 
+/* State of one slice of an export */
+typedef struct {
+    transport_session_t * session;
+    const char * index;
+    const char * type;
+    buf_t query;
+    /* output file, shared by all slices when lock is not NULL */
+    FILE * file;
+    pthread_mutex_t * lock;
+    buf_t out;
+    pthread_t thread;
+    int started;
+    int result;
+} transport_export_slice_t;
+
 /**
- * @brief Explicitly refreshes an elastic index.
+ * @brief Writes the buffered lines of a slice to its file.
  *
- * @param session transport session struct.
- * @param index elastic index
+ * @param slice export slice
  *
  * @return 0 on success or transport error code.
  */
 static int
-transport_refresh(transport_session_t * session, const char * index) {
-    char path[TRANSPORT_CALL_URL_LEN];
-    const char * total_path[] = {"_shards", "total", NULL},
-               * successful_path[] = {"_shards", "successful", NULL},
-               * failed_path[] = {"_shards", "failed", NULL},
-               * status_path[] = {"status", NULL},
-               * error_path[] = {"error", NULL};
-    yajl_val node, v;
-    int ret = 0;
-    char eb[1024];
+transport_export_flush(transport_export_slice_t * slice) {
+    size_t written;
 
-    session->type = TRANS_SESSION_TYPE_NONE;
-
-    if (!transport_build_url(index, NULL, "_refresh", path, TRANSPORT_CALL_URL_LEN)) {
-        return TRANS_ERROR_URL;
+    if (slice->out.pos == 0) {
+        return 0;
     }
-    ret = transport_http_post(session, path, NULL);
-    if (ret != 0) {
-        return ret;
+    if (slice->lock != NULL) {
+        pthread_mutex_lock(slice->lock);
     }
-
-    /* parse response */
-    node = yajl_tree_parse(session->raw.buffer, eb, sizeof(eb));
-    if (node == NULL) {
-        return TRANS_ERROR_PARSE;
+    written = fwrite(slice->out.buffer, 1, slice->out.pos, slice->file);
+    if (slice->lock != NULL) {
+        pthread_mutex_unlock(slice->lock);
     }
+    if (written != slice->out.pos) {
+        return TRANS_ERROR_IO;
+    }
+    slice->out.pos = 0;
+    return 0;
+}
 
-    /* store error and status, if any, in document response */
-    if ((v = yajl_tree_get(node, error_path, yajl_t_string)) != NULL) {
-        ret = TRANS_ERROR_ELASTIC;
-        strncpy(session->error.error, YAJL_GET_STRING(v), TRANSPORT_ERROR_LEN);
-        if ((v = yajl_tree_get(node, status_path, yajl_t_number)) != NULL) {
-            session->error.status = atoi(YAJL_GET_NUMBER(v));
-        }
-        session->type = TRANS_SESSION_TYPE_ERROR;
-    } else {
-        if ((v = yajl_tree_get(node, total_path, yajl_t_number)) != NULL) {
-            session->refresh._shards.total = atoi(YAJL_GET_NUMBER(v));
-        }
-        if ((v = yajl_tree_get(node, successful_path, yajl_t_number)) != NULL) {
-            session->refresh._shards.successful = atoi(YAJL_GET_NUMBER(v));
+/**
+ * @brief Appends a page of hits to the write buffer of a slice as NDJSON,
+ * one {"_index","_id","_source"} object per line copied from the raw
+ * response.
+ *
+ * @param slice export slice
+ * @param page session holding the page
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_export_page(transport_export_slice_t * slice, transport_session_t * page) {
+    int ret;
+
+    for (size_t i = 0; i < page->search.hits.num_hits; i++) {
+        _hit_r * hit = &page->search.hits.hits[i];
+        /* a hit without _source, e.g. with _source disabled, exports null */
+        int has_source = hit->_source_span.length > 0;
+        if (transport_buf_append(&slice->out, "{\"_index\":\"", 11) != 0 ||
+                transport_buf_append(&slice->out, TRANSPORT_SPAN(page, hit->_index_span), hit->_index_span.length) != 0 ||
+                transport_buf_append(&slice->out, "\",\"_id\":\"", 9) != 0 ||
+                transport_buf_append(&slice->out, TRANSPORT_SPAN(page, hit->_id_span), hit->_id_span.length) != 0 ||
+                transport_buf_append(&slice->out, "\",\"_source\":", 12) != 0 ||
+                transport_buf_append(&slice->out, has_source ? TRANSPORT_SPAN(page, hit->_source_span) : "null",
+                    has_source ? hit->_source_span.length : 4) != 0 ||
+                transport_buf_append(&slice->out, "}\n", 2) != 0) {
+            return TRANS_ERROR_MEMORY;
         }
-        if ((v = yajl_tree_get(node, failed_path, yajl_t_number)) != NULL) {
-            session->refresh._shards.failed = atoi(YAJL_GET_NUMBER(v));
+        if (slice->out.pos >= TRANSPORT_EXPORT_BUFFER_LEN && (ret = transport_export_flush(slice)) != 0) {
+            return ret;
         }
-        session->type = TRANS_SESSION_TYPE_REFRESH;
     }
-
-    return ret;
+    return 0;
 }
 
 /**
- * @brief Create and initialize a transport session struct.
+ * @brief Export thread, scrolls through one slice.
  *
- * @param config Path to configuration file.
+ * @param arg export slice
  *
- * @return a transport session struct.
+ * @return NULL
  */
-static transport_session_t *
-transport_create(const char * config) {
-
-    transport_session_t * session = NULL;
-    config_t cfg;
-    config_setting_t * setting;
-    int host_count;
-
-    config_init(&cfg);
-
-    /* seed the random number generator */
-    srand((unsigned int)time(NULL) * getpid());
+static void *
+transport_export_thread(void * arg) {
+    transport_export_slice_t * slice = (transport_export_slice_t *) arg;
+    transport_scroll_t * scroll;
+    transport_session_t * page;
+    int ret;
 
-    /* allocate memory for session struct. */
-    if ((session = malloc(sizeof (transport_session_t))) == NULL) {
-        fprintf(stderr, "transport.create() failed: could not initialize transport session.\n");
+    scroll = transport_scroll_create(slice->session, slice->index, slice->type, slice->query.buffer, NULL, TRANS_SCROLL_SCROLL_ID);
+    if (scroll == NULL) {
+        slice->result = TRANS_ERROR_MEMORY;
         return NULL;
     }
-
-    /* initialize curl. */
-    if ((session->curl = curl_easy_init()) == NULL) {
-        fprintf(stderr, "transport.create() failed: could not initialize curl.\n");
-        goto transport_create_error;
+    while ((ret = transport_scroll_next(scroll, &page)) == 0 && page != NULL) {
+        if ((ret = transport_export_page(slice, page)) != 0) {
+            break;
+        }
     }
+    if (ret == 0) {
+        ret = transport_export_flush(slice);
+    }
+    transport_scroll_destroy(scroll);
+    slice->result = ret;
+    return NULL;
+}
 
-    /* reset response buffer */
-    session->raw.buffer[0] = '\0';
-    session->raw.pos = 0;
-
-    /* generate a kind of unique session id */
-    transport_session_id((char *)&session->id, TRANSPORT_SESSION_ID_LEN); 
+/**
+ * @brief Exports all documents matching a query to NDJSON files. The
+ * index is split into sliced scrolls that run in parallel, each on its own
+ * thread and connections.
+ *
+ * @param session transport session struct, its configuration is used for
+ * the sessions of the slices
+ * @param index elastic index
+ * @param type elastic type
+ * @param payload search body, a JSON object, NULL to export everything
+ * @param slices number of slices
+ * @param path output file
+ * @param per_slice non zero to write slice i to path.i instead of one file
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_export(transport_session_t * session, const char * index, const char * type, const char * payload,
+        size_t slices, const char * path, int per_slice) {
+    transport_export_slice_t * slice = NULL;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    FILE * file = NULL;
+    char member[64];
+    int ret = 0;
 
-    /* load config. */
-    if (!config_read_file(&cfg, config)) {
-        fprintf(stderr, "transport.create() failed: could not parse config file.\n");
-        goto transport_create_error;
+    if (session == NULL || index == NULL || path == NULL || slices == 0) {
+        return TRANS_ERROR_INPUT;
     }
-
-    /* lookup timeout from config and store the value in session.  */
-    if (!config_lookup_int(&cfg, "timeout", &session->timeout)) {
-        session->timeout = TRANSPORT_DEFAULT_TIMEOUT;
+    if (payload == NULL) {
+        payload = "{}";
     }
-
-    /* load hosts from config. */
-    if ((setting = config_lookup(&cfg, "hosts")) == NULL) {
-        goto transport_create_error;
+    if ((slice = calloc(slices, sizeof (transport_export_slice_t))) == NULL) {
+        return TRANS_ERROR_MEMORY;
     }
-    host_count = config_setting_length(setting);
-    if (host_count == 0) {
-        fprintf(stderr, "transport.create() failed: missing 'hosts' in configuration file.\n");
-        goto transport_create_error;
+    if (!per_slice && (file = fopen(path, "w")) == NULL) {
+        free(slice);
+        return TRANS_ERROR_IO;
     }
 
-    /* store hosts in session struct. */
-    for (int i = 0; i < host_count && i < TRANSPORT_MAX_HOSTS; ++i) {
-        const char * h = NULL;
-        config_setting_t * host = config_setting_get_elem(setting, i);
-        if (!(config_setting_lookup_string(host, "host", &h) && config_setting_lookup_int(host, "port", &session->hosts[session->num_hosts].port))) {
-            continue;
+    for (size_t i = 0; i < slices && ret == 0; i++) {
+        slice[i].index = index;
+        slice[i].type = type;
+        slice[i].file = file;
+        slice[i].lock = slices > 1 && !per_slice ? &lock : NULL;
+        if (per_slice) {
+            char name[FILENAME_MAX];
+            snprintf(name, sizeof (name), "%s.%zu", path, i);
+            if ((slice[i].file = fopen(name, "w")) == NULL) {
+                ret = TRANS_ERROR_IO;
+                break;
+            }
+        }
+        /* elastic rejects a slice clause with a single slice */
+        if (slices > 1) {
+            int len = snprintf(member, sizeof (member), "\"slice\":{\"id\":%zu,\"max\":%zu}", i, slices);
+            ret = transport_buf_append_merged(&slice[i].query, member, len, payload);
+        } else if (transport_buf_append(&slice[i].query, payload, strlen(payload)) != 0) {
+            ret = TRANS_ERROR_MEMORY;
+        }
+        if (ret != 0) {
+            break;
+        }
+        /* hits are written from the raw response, _source is never re-encoded */
+        if ((slice[i].session = transport_session_clone(session)) == NULL) {
+            ret = TRANS_ERROR_MEMORY;
+            break;
         }
-        strncpy(session->hosts[session->num_hosts].host, h, TRANSPORT_HOST_LEN);
-        session->num_hosts++;
+        slice[i].session->options |= TRANS_OPTION_ZERO_COPY;
+        if (pthread_create(&slice[i].thread, NULL, transport_export_thread, &slice[i]) != 0) {
+            ret = TRANS_ERROR_MEMORY;
+            break;
+        }
+        slice[i].started = 1;
     }
 
-    config_destroy(&cfg);
-    return session;
-
-transport_create_error:
-    /* cleanup */
-    if (session != NULL) {  
-        if (session->curl != NULL) {
-            curl_easy_cleanup(session->curl);
+    for (size_t i = 0; i < slices; i++) {
+        if (slice[i].started) {
+            pthread_join(slice[i].thread, NULL);
+            if (ret == 0) {
+                ret = slice[i].result;
+            }
         }
-        free(session);
-        session = NULL;
+        if (per_slice && slice[i].file != NULL && fclose(slice[i].file) != 0 && ret == 0) {
+            ret = TRANS_ERROR_IO;
+        }
+        transport_destroy(slice[i].session);
+        transport_buf_free(&slice[i].query);
+        transport_buf_free(&slice[i].out);
     }
-    if (&cfg != NULL) {
-        config_destroy(&cfg);
+    if (file != NULL && fclose(file) != 0 && ret == 0) {
+        ret = TRANS_ERROR_IO;
     }
-    return NULL;
+    free(slice);
+    return ret;
+}
+
+/**
+ * @brief Sets the absolute deadline of the following requests of a
+ * session. Failover attempts only get the time that is left.
+ *
+ * @param session transport session struct.
+ * @param deadline milliseconds on the clock of transport.now, 0 for no
+ * deadline.
+ */
+static void
+transport_set_deadline(transport_session_t * session, long long deadline) {
+    if (session != NULL) {
+        session->deadline = deadline;
+    }
+}
+
+/**
+ * @brief Gives the following requests of a session budget milliseconds
+ * from now, including all failover attempts.
+ *
+ * @param session transport session struct.
+ * @param budget milliseconds, 0 for no deadline.
+ */
+static void
+transport_set_budget(transport_session_t * session, long budget) {
+    transport_set_deadline(session, budget > 0 ? transport_now_ms() + budget : 0);
 }
 
 /**
@@ -727,7 +5532,24 @@ transport_http_get(transport_session_t * session, const char * path) {
     if (session == NULL) {
         return TRANS_ERROR_INPUT;
     }
-    return transport_call(session, path, TRANS_METHOD_GET, NULL);
+    return transport_call_hedged(session, path, TRANS_METHOD_GET, NULL, NULL);
+}
+
+/**
+ * @brief Start an asynchronous HTTP GET request, the raw response is in
+ * session->raw when callback is called.
+ *
+ * @param multi multi struct
+ * @param session transport session struct.
+ * @param path URL path
+ * @param callback completion callback
+ * @param userdata passed to callback
+ *
+ * @return 0 on success or transport error code.
+ */
+static int
+transport_async_http_get(transport_multi_t * multi, transport_session_t * session, const char * path, transport_callback_t callback, void * userdata) {
+    return transport_submit(multi, session, path, TRANS_METHOD_GET, NULL, NULL, NULL, callback, userdata);
 }
 
 /**
@@ -744,7 +5566,7 @@ transport_http_post(transport_session_t * session, const char * path, const char
     if (session == NULL) {
         return TRANS_ERROR_INPUT;
     }
-    return transport_call(session, path, TRANS_METHOD_POST, payload);
+    return transport_call(session, path, TRANS_METHOD_POST, payload, NULL);
 }
 
 /**
@@ -761,7 +5583,7 @@ transport_http_put(transport_session_t * session, const char * path, const char
     if (session == NULL) {
         return TRANS_ERROR_INPUT;
     }
-    return transport_call(session, path, TRANS_METHOD_PUT, payload);
+    return transport_call(session, path, TRANS_METHOD_PUT, payload, NULL);
 }
 
 /**
@@ -778,7 +5600,7 @@ transport_http_delete(transport_session_t * session, const char * path, const ch
     if (session == NULL) {
         return TRANS_ERROR_INPUT;
     }
-    return transport_call(session, path, TRANS_METHOD_DELETE, payload);
+    return transport_call(session, path, TRANS_METHOD_DELETE, payload, NULL);
 }
 
 /**
@@ -791,7 +5613,23 @@ transport_destroy(transport_session_t * session) {
     if (session == NULL) {
         return;
     }
-    session->raw.pos = 0;
+    if (session->multi != NULL) {
+        transport_host_end(session, CURLE_ABORTED_BY_CALLBACK);
+        transport_write_release(session);
+        transport_detach(session);
+    }
+    transport_buf_free(&session->raw);
+    transport_buf_free(&session->compressed);
+    for (int i = 0; i < TRANSPORT_HEADER_PLANS; i++) {
+        curl_slist_free_all(session->headers[i]);
+    }
+    transport_arena_free(session);
+    free(session->parser);
+    transport_hosts_release(session->hosts);
+    if (session->hedge_multi != NULL) {
+        curl_multi_cleanup(session->hedge_multi);
+    }
+    transport_destroy(session->hedge);
     if (session->curl != NULL) {
         curl_easy_cleanup(session->curl);
     }
@@ -825,6 +5663,16 @@ transport_strerror(int error) {
             return "Parse error";
         case TRANS_ERROR_ELASTIC:
             return "Elastic error";
+        case TRANS_ERROR_MEMORY:
+            return "Out of memory";
+        case TRANS_ERROR_BULK:
+            return "Bulk item error";
+        case TRANS_ERROR_BUSY:
+            return "Session busy";
+        case TRANS_ERROR_IO:
+            return "I/O error";
+        case TRANS_ERROR_LIMIT:
+            return "Write limit reached";
         default:
             return "Unknown error";
         }
@@ -843,7 +5691,39 @@ _transport_t const transport = {
     transport_http_put,
     transport_http_delete,
     transport_strerror,
-    transport_destroy
+    transport_destroy,
+    transport_bulk_create,
+    transport_bulk_add,
+    transport_bulk_raw,
+    transport_bulk_flush,
+    transport_bulk_destroy,
+    transport_multi_create,
+    transport_async_search,
+    transport_async_index_document,
+    transport_async_http_get,
+    transport_poll,
+    transport_multi_destroy,
+    transport_multi_events,
+    transport_socket_action,
+    transport_pool_create,
+    transport_pool_checkout,
+    transport_pool_checkin,
+    transport_pool_destroy,
+    transport_scroll_create,
+    transport_scroll_next,
+    transport_scroll_destroy,
+    transport_export,
+    transport_sniff,
+    transport_now_ms,
+    transport_set_deadline,
+    transport_set_budget,
+    transport_config_load,
+    transport_create_from,
+    transport_config_destroy,
+    transport_msearch,
+    transport_get,
+    transport_mget,
+    transport_exists
 };
 
 int main(int argc, char **argv) {